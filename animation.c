@@ -0,0 +1,305 @@
+/*
+ * animation.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Each animation is a string of bytes in program memory. It starts with
+ * the time between frames (milliseconds), the number of colours it uses
+ * and those colours. The rest is commands, each a command code followed
+ * by its arguments, which draw a frame and then show it:
+ *	OP_KEY runs...			draw every pixel (a key frame)
+ *	OP_RUNS p n runs...		draw n runs starting at pixel position p
+ *	OP_COLUMN x runs...		draw column x, top to bottom
+ *	OP_CLEAR				clear the display
+ *	OP_SHIFT_LEFT etc.		shift the display (the column or row that
+ *							comes in should be drawn afterwards)
+ *	OP_SHOW n				show the frame, and keep it for n frame times
+ *	OP_MARK					mark where OP_LOOP goes back to (the first
+ *							command if there is no mark)
+ *	OP_LOOP n				go back to the mark, until the part between
+ *							has been played n times (0 means forever)
+ *	OP_END					the animation has finished
+ * Pixel positions go across each row from the top left (see RASTER()).
+ * A run is one byte - the number of pixels less 1 (so 1 to 16) in the
+ * top 4 bits, and the colour (its place in the colour list) in the
+ * bottom 4 bits. Runs go on to the next row.
+ *
+ * Only changes are stored, and the LED matrix is sent only what changes
+ * (each frame is drawn as an LED matrix frame), so playing an animation
+ * takes little time and no RAM beyond a few pointers.
+ */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "animation.h"
+#include "ledmatrix.h"
+#include "timer0.h"
+
+#define OP_END 0
+#define OP_SHOW 1
+#define OP_KEY 2
+#define OP_RUNS 3
+#define OP_COLUMN 4
+#define OP_CLEAR 5
+#define OP_SHIFT_LEFT 6
+#define OP_SHIFT_RIGHT 7
+#define OP_SHIFT_UP 8
+#define OP_SHIFT_DOWN 9
+#define OP_MARK 10
+#define OP_LOOP 11
+
+#define RUN(length, colour) ((((length) - 1) << 4) | (colour))
+#define RASTER(x, row) ((row) * MATRIX_NUM_COLUMNS + (x))	// Row 0 is the top
+#define NUM_PIXELS (MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS)
+
+/* Splash screen - a car driving to the right along a road, shown by
+ * moving the road (with its centre line) to the left.
+ */
+enum { SPLASH_BLACK, SPLASH_GRASS, SPLASH_LINE, SPLASH_CAR };
+
+#define ROAD_STEP(line) \
+	OP_SHIFT_LEFT, \
+	OP_COLUMN, 15, RUN(1, SPLASH_GRASS), RUN(2, SPLASH_BLACK), RUN(1, line), \
+			RUN(3, SPLASH_BLACK), RUN(1, SPLASH_GRASS), \
+	OP_RUNS, RASTER(1, 4), 2, RUN(1, SPLASH_BLACK), RUN(3, SPLASH_CAR), \
+	OP_RUNS, RASTER(1, 5), 2, RUN(1, SPLASH_BLACK), RUN(3, SPLASH_CAR), \
+	OP_SHOW, 1
+
+static const uint8_t anim_splash[] PROGMEM = {
+	100, 4, COLOUR_BLACK, COLOUR_GREEN, COLOUR_LIGHT_YELLOW, COLOUR_ORANGE,
+	OP_KEY,
+		RUN(16, SPLASH_GRASS),
+		RUN(16, SPLASH_BLACK),
+		RUN(16, SPLASH_BLACK),
+		RUN(2, SPLASH_LINE), RUN(2, SPLASH_BLACK), RUN(2, SPLASH_LINE), RUN(2, SPLASH_BLACK),
+		RUN(2, SPLASH_LINE), RUN(2, SPLASH_BLACK), RUN(2, SPLASH_LINE), RUN(2, SPLASH_BLACK),
+		RUN(2, SPLASH_BLACK), RUN(3, SPLASH_CAR), RUN(11, SPLASH_BLACK),
+		RUN(2, SPLASH_BLACK), RUN(3, SPLASH_CAR), RUN(11, SPLASH_BLACK),
+		RUN(16, SPLASH_BLACK),
+		RUN(16, SPLASH_GRASS),
+	OP_SHOW, 1,
+	OP_MARK,
+	ROAD_STEP(SPLASH_LINE),
+	ROAD_STEP(SPLASH_LINE),
+	ROAD_STEP(SPLASH_BLACK),
+	ROAD_STEP(SPLASH_BLACK),
+	OP_LOOP, 8,
+	OP_END
+};
+
+/* Lap complete - a chequered flag moving to the left.
+ */
+enum { FLAG_BLACK, FLAG_YELLOW };
+
+#define FLAG_ROW(a, b) \
+	RUN(2, a), RUN(2, b), RUN(2, a), RUN(2, b), RUN(2, a), RUN(2, b), RUN(2, a), RUN(2, b)
+#define FLAG_STEP(a, b) \
+	OP_SHIFT_LEFT, \
+	OP_COLUMN, 15, RUN(2, a), RUN(2, b), RUN(2, a), RUN(2, b), \
+	OP_SHOW, 1
+
+static const uint8_t anim_lap_complete[] PROGMEM = {
+	80, 2, COLOUR_BLACK, COLOUR_YELLOW,
+	OP_KEY,
+		FLAG_ROW(FLAG_YELLOW, FLAG_BLACK),
+		FLAG_ROW(FLAG_YELLOW, FLAG_BLACK),
+		FLAG_ROW(FLAG_BLACK, FLAG_YELLOW),
+		FLAG_ROW(FLAG_BLACK, FLAG_YELLOW),
+		FLAG_ROW(FLAG_YELLOW, FLAG_BLACK),
+		FLAG_ROW(FLAG_YELLOW, FLAG_BLACK),
+		FLAG_ROW(FLAG_BLACK, FLAG_YELLOW),
+		FLAG_ROW(FLAG_BLACK, FLAG_YELLOW),
+	OP_SHOW, 1,
+	OP_MARK,
+	FLAG_STEP(FLAG_YELLOW, FLAG_BLACK),
+	FLAG_STEP(FLAG_YELLOW, FLAG_BLACK),
+	FLAG_STEP(FLAG_BLACK, FLAG_YELLOW),
+	FLAG_STEP(FLAG_BLACK, FLAG_YELLOW),
+	OP_LOOP, 0
+};
+
+/* Game over - a red curtain comes down, then a cross flashes.
+ */
+enum { OVER_BLACK, OVER_RED };
+
+#define CURTAIN_ROW(row) OP_RUNS, RASTER(0, row), 1, RUN(16, OVER_RED), OP_SHOW, 1
+
+static const uint8_t anim_game_over[] PROGMEM = {
+	100, 2, COLOUR_BLACK, COLOUR_RED,
+	CURTAIN_ROW(0),
+	CURTAIN_ROW(1),
+	CURTAIN_ROW(2),
+	CURTAIN_ROW(3),
+	CURTAIN_ROW(4),
+	CURTAIN_ROW(5),
+	CURTAIN_ROW(6),
+	CURTAIN_ROW(7),
+	OP_SHOW, 4,
+	OP_MARK,
+	OP_KEY,
+		RUN(4, OVER_BLACK), RUN(1, OVER_RED), RUN(6, OVER_BLACK), RUN(1, OVER_RED), RUN(4, OVER_BLACK),
+		RUN(5, OVER_BLACK), RUN(1, OVER_RED), RUN(4, OVER_BLACK), RUN(1, OVER_RED), RUN(5, OVER_BLACK),
+		RUN(6, OVER_BLACK), RUN(1, OVER_RED), RUN(2, OVER_BLACK), RUN(1, OVER_RED), RUN(6, OVER_BLACK),
+		RUN(7, OVER_BLACK), RUN(2, OVER_RED), RUN(7, OVER_BLACK),
+		RUN(7, OVER_BLACK), RUN(2, OVER_RED), RUN(7, OVER_BLACK),
+		RUN(6, OVER_BLACK), RUN(1, OVER_RED), RUN(2, OVER_BLACK), RUN(1, OVER_RED), RUN(6, OVER_BLACK),
+		RUN(5, OVER_BLACK), RUN(1, OVER_RED), RUN(4, OVER_BLACK), RUN(1, OVER_RED), RUN(5, OVER_BLACK),
+		RUN(4, OVER_BLACK), RUN(1, OVER_RED), RUN(6, OVER_BLACK), RUN(1, OVER_RED), RUN(4, OVER_BLACK),
+	OP_SHOW, 6,
+	OP_CLEAR,
+	OP_SHOW, 3,
+	OP_LOOP, 0
+};
+
+static const uint8_t* const animations[NUM_ANIMATIONS] PROGMEM = {
+	anim_splash, anim_lap_complete, anim_game_over
+};
+
+// The animation playing - its colours, its next command (0 if none is
+// playing), the mark, and the passes made through the loop so far
+static const uint8_t* colours;
+static const uint8_t* next;
+static const uint8_t* mark;
+static uint8_t loops;
+
+// Time between frames (milliseconds), and when (low 16 bits of the clock
+// tick count) the next frame is due
+static uint8_t period;
+static uint16_t due;
+
+/* Set a pixel on every panel to the animation's colour number colour.
+ */
+static void draw_pixel(uint8_t x, uint8_t y, uint8_t colour) {
+	PixelColour pixel = pgm_read_byte(&colours[colour]);
+	uint8_t panel;
+
+	for(panel = 0; panel < LED_NUM_PANELS; panel++) {
+		ledmatrix_update_pixel(panel * MATRIX_NUM_COLUMNS + x, y, pixel);
+	}
+}
+
+/* Draw the next run from pixel position onwards. Returns the position
+ * after it.
+ */
+static uint8_t draw_run(uint8_t position) {
+	uint8_t run = pgm_read_byte(next++);
+	uint8_t length = (run >> 4) + 1;
+
+	for(; length > 0 && position < NUM_PIXELS; length--, position++) {
+		draw_pixel(position % MATRIX_NUM_COLUMNS,
+				MATRIX_NUM_ROWS - 1 - position / MATRIX_NUM_COLUMNS, run & 0x0F);
+	}
+	return position;
+}
+
+/* Draw column x from the runs that follow, top to bottom.
+ */
+static void draw_column(uint8_t x) {
+	int8_t y = MATRIX_NUM_ROWS - 1;
+	uint8_t run, length;
+
+	while(y >= 0) {
+		run = pgm_read_byte(next++);
+		for(length = (run >> 4) + 1; length > 0 && y >= 0; length--, y--) {
+			draw_pixel(x, y, run & 0x0F);
+		}
+	}
+}
+
+void animation_start(AnimationId id) {
+	const uint8_t* animation = (const uint8_t*)pgm_read_word(&animations[id]);
+
+	period = pgm_read_byte(&animation[0]);
+	colours = &animation[2];
+	next = mark = colours + pgm_read_byte(&animation[1]);
+	loops = 0;
+	// The first frame is drawn straight away
+	due = get_timer0_clock_ticks();
+}
+
+void animation_stop(void) {
+	next = 0;
+}
+
+uint8_t animation_playing(void) {
+	return next != 0;
+}
+
+uint8_t animation_update(void) {
+	uint16_t now;
+	uint8_t command, count, position;
+
+	if(!next) {
+		return 0;
+	}
+	now = get_timer0_clock_ticks();
+	if((int16_t)(now - due) < 0) {
+		return 1;
+	}
+
+	// Carry out commands up to the end of the frame
+	ledmatrix_begin_frame();
+	do {
+		command = pgm_read_byte(next++);
+		switch(command) {
+			case OP_SHOW:
+				// The next frame is due count frame times after this one
+				// was (unless we've fallen that far behind)
+				count = pgm_read_byte(next++);
+				due += count * period;
+				if((int16_t)(now - due) >= 0) {
+					due = now + count * period;
+				}
+				break;
+			case OP_KEY:
+				position = 0;
+				while(position < NUM_PIXELS) {
+					position = draw_run(position);
+				}
+				break;
+			case OP_RUNS:
+				position = pgm_read_byte(next++);
+				count = pgm_read_byte(next++);
+				for(; count > 0; count--) {
+					position = draw_run(position);
+				}
+				break;
+			case OP_COLUMN:
+				draw_column(pgm_read_byte(next++));
+				break;
+			case OP_CLEAR:
+				ledmatrix_clear();
+				break;
+			case OP_SHIFT_LEFT:
+				ledmatrix_shift_display_left();
+				break;
+			case OP_SHIFT_RIGHT:
+				ledmatrix_shift_display_right();
+				break;
+			case OP_SHIFT_UP:
+				ledmatrix_shift_display_up();
+				break;
+			case OP_SHIFT_DOWN:
+				ledmatrix_shift_display_down();
+				break;
+			case OP_MARK:
+				mark = next;
+				break;
+			case OP_LOOP:
+				count = pgm_read_byte(next++);
+				if(count == 0 || ++loops < count) {
+					next = mark;
+				} else {
+					loops = 0;
+				}
+				break;
+			default:
+				// OP_END
+				next = 0;
+				break;
+		}
+	} while(command != OP_SHOW && next);
+	ledmatrix_commit_frame();
+	return next != 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * animation.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Animations for the LED matrix. They are kept compressed in program
+ * memory (see animation.c) and played from the main loop, a frame at a
+ * time, in the same way as scrolling text (see scrolling_char_display.h).
+ * One animation plays at a time.
+ */
+
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include <stdint.h>
+
+typedef enum {
+	ANIMATION_SPLASH,			// Car driving along a road
+	ANIMATION_LAP_COMPLETE,		// Chequered flag
+	ANIMATION_GAME_OVER,		// Red curtain, then a flashing cross
+	NUM_ANIMATIONS
+} AnimationId;
+
+/* Start playing an animation from its first frame, replacing any
+ * animation that is playing. Each panel of the LED matrix shows the same
+ * picture.
+ */
+void animation_start(AnimationId id);
+
+/* Stop the animation. The display is left as it is.
+ */
+void animation_stop(void);
+
+/* Return 1 while an animation is playing, 0 once it has finished (or was
+ * stopped). Some animations repeat until they are stopped.
+ */
+uint8_t animation_playing(void);
+
+/* Draw the next frame if it is due (by the timer 0 clock). Call this
+ * often from the main loop - it never waits (other than for room in the
+ * SPI queue). Returns animation_playing().
+ */
+uint8_t animation_update(void);
+
+#endif /* ANIMATION_H_ */
@@ -8,6 +8,9 @@
  * orientation. 
  * Display columns (0 to 15) are game rows 15 (top) to 0 (bottom) in this orientation.
  * Display rows (0 to 7) are game columns 0 (left) to 7 (right) in this orientation.
+ * With more than one LED matrix panel (see ledmatrix.h) the display has more
+ * columns, so more game rows are shown - the track ahead can be seen further.
+ * The terminal (and telemetry) show the bottom TERM_NUM_ROWS game rows.
  */ 
 
 #include <stdint.h>
@@ -15,10 +18,12 @@
 
 #include "game.h"
 #include "ledmatrix.h"
+#include "gfx.h"
 #include "timer0.h"
 #include "timer2.h"
 #include "terminalio.h"
 #include "term.h"
+#include "telemetry.h"
 
 ///////////////////////////////// Global variables //////////////////////
 // car_column stores the current position of the car. Game columns are numbered
@@ -43,6 +48,9 @@ static uint8_t lives;
 // Maximum number of player lives
 #define MAX_LIVES 3
 
+// Number of game rows shown on the LED matrix
+#define NUM_DISPLAY_ROWS LED_DISPLAY_COLUMNS
+
 // Background - 8 bits in each row. A 1 indicates background being
 // present, a 0 is empty space. We will scroll through this and
 // return to the other end. Bit 0 (LSB) in these patterns will end
@@ -112,6 +120,7 @@ static uint8_t powerup_colour = COLOUR_POWERUP;
 static uint8_t car_crashes_at(uint8_t column, uint8_t extend);
 static void redraw_background(void);
 static void redraw_game_row(uint8_t row);
+static void redraw_term_row(uint8_t row);
 static void draw_start_or_finish_line(uint8_t row);
 static void redraw_car();
 static uint8_t check_if_background(uint8_t row, uint8_t column);
@@ -141,18 +150,23 @@ void init_game(void) {
 	place_powerup();
 	powerup = 0; // Always turn off powerup at start of game
 
+	ledmatrix_begin_frame();
 	clear_terminal();
-	set_scroll_region(8, 23);
+	term_reset();
 	redraw_background();
+	telemetry_request_full_frame();
 	
 	// Add a car to the display. (This will redraw the car.)
 	put_car_at_start();
+	ledmatrix_commit_frame();
+	term_flush();
 }
 
 // Add a car to the game, placed at an empty background.
 void put_car_at_start(void) {
 	// Initial starting position of car. It must be guaranteed that this
 	// initial position does not clash with the background.
+	ledmatrix_begin_frame();
 	erase_car();
 	srandom(get_timer0_clock_ticks());
 	// Keep on changing column until car does not clash
@@ -168,29 +182,35 @@ void put_car_at_start(void) {
 
 	// Show the car
 	redraw_car();
+	ledmatrix_commit_frame();
 }
 
 void move_car_left(void) {
 	if(car_column != 0) {
-		// Car not at left hand side
+		// Car not at left hand side. (The car is moved in one frame so
+		// it is never seen missing.)
+		ledmatrix_begin_frame();
 		erase_car();
 		car_column--;
 		car_crashed = car_crashes_at(car_column, 0);
 		// Check if car on power-up pixel
 		powerup_check();
 		redraw_car();
+		ledmatrix_commit_frame();
 	} // else car is at left hand side (column 0) and can't move left
 }
 
 void move_car_right(void) {
 	if(car_column != 7) {
 		// Car not at right hand side
+		ledmatrix_begin_frame();
 		erase_car();
 		car_column++;
 		car_crashed = car_crashes_at(car_column, 0);
 		// Check if car on power-up pixel
 		powerup_check();
 		redraw_car();
+		ledmatrix_commit_frame();
 	} // else car is at right hand side (column 7) and can't move right
 }
 
@@ -246,14 +266,16 @@ void toggle_car_colour(uint8_t reset) {
 	} else {
 		car_colour = (car_colour == COLOUR_CAR ? COLOUR_POWERUP:COLOUR_CAR);
 	}
+	ledmatrix_begin_frame();
 	redraw_car();
+	ledmatrix_commit_frame();
 }
 
 void scroll_background(void) {
 	scroll_position++;
 	// Display power-up if position reached
 	if(scroll_position == powerup_scroll_position) {
-		powerup_row = 16; // 16 instead of 15 cause will be decreased right away below
+		powerup_row = NUM_DISPLAY_ROWS; // One above the top row cause will be decreased right away below
 	}
 	// Shift power-up pixel
 	if(powerup_row > -1) {
@@ -276,16 +298,23 @@ void scroll_background(void) {
 
 	// For speed purposes, we don't redraw the whole display, we
 	// erase the car, shift the display down (right in the sense of the
-	// LED matrix) and redraw the car and draw the new row 15
+	// LED matrix) and redraw the car and draw the new top row. This is all
+	// one frame, so the LED matrix gets just the changes, all together.
+	ledmatrix_begin_frame();
 	erase_car();
 	ledmatrix_shift_display_right(); // Scroll LED matrix
-	scroll_down(); // Scroll terminal
+	term_scroll_down(); // Scroll terminal
 	redraw_car();
-	redraw_game_row(15);
+	redraw_game_row(NUM_DISPLAY_ROWS - 1);
+	if(NUM_DISPLAY_ROWS > TERM_NUM_ROWS) {
+		// The terminal's new top row is further down
+		redraw_term_row(TERM_NUM_ROWS - 1);
+	}
 	if(powerup_display()) {
 		// Display power-up pixel
 		redraw_powerup();
 	}
+	ledmatrix_commit_frame();
 }
 
 uint8_t get_background_data(uint8_t row) {
@@ -293,6 +322,44 @@ uint8_t get_background_data(uint8_t row) {
 	return background_data[race_row % NUM_GAME_ROWS];
 }
 
+uint8_t get_scroll_position(void) {
+	return scroll_position;
+}
+
+uint8_t is_start_or_finish_row(uint8_t row) {
+	uint8_t race_row = scroll_position + row;
+	return race_row - initial_scroll == 0 || race_row - initial_scroll == RACE_DISTANCE;
+}
+
+PixelColour get_car_colour(void) {
+	return car_colour;
+}
+
+int8_t get_powerup_row(void) {
+	return powerup_display() ? powerup_row : -1;
+}
+
+int8_t get_powerup_column(void) {
+	return powerup_column;
+}
+
+PixelColour get_powerup_colour(void) {
+	return powerup_colour;
+}
+
+void redraw_display(void) {
+	ledmatrix_begin_frame();
+	clear_terminal();
+	term_reset();
+	redraw_background();
+	redraw_car();
+	if(powerup_display()) {
+		redraw_powerup();
+	}
+	ledmatrix_commit_frame();
+	term_flush();
+}
+
 /////////////////////////////// Private (Helper) Functions /////////////////////
 
 // Return 1 if the car crashes if moved into the given column. We compare the car
@@ -326,53 +393,46 @@ static void redraw_background() {
 	ledmatrix_clear();
 	
 	uint8_t row;
-	for(row = 0; row <= 15; row++) {
+	for(row = 0; row < NUM_DISPLAY_ROWS; row++) {
 		redraw_game_row(row);
 	}
 }
 
-// Redraw the row with the given number (0 to 15). The car is not redrawn.
-// Rows in the game are columns in the terminology of the display
+// Redraw the row with the given number on the terminal only.
+static void redraw_term_row(uint8_t row) {
+	if(is_start_or_finish_row(row)) {
+		term_draw_start_or_finish_line(row);
+	} else {
+		term_redraw_game_row(row);
+	}
+}
+
+// Redraw the row with the given number (0 to NUM_DISPLAY_ROWS - 1). The car is not redrawn.
+// Rows in the game are columns in the terminology of the display, so a
+// row is drawn in one go from its background bits.
 static void redraw_game_row(uint8_t row) {	
-	MatrixColumn row_display_data; // Note that a game row corresponds to a display
-								   // column.
-	uint8_t i;
 	uint8_t race_row = scroll_position + row;
-	if(race_row - initial_scroll == 0 || race_row - initial_scroll == RACE_DISTANCE) {
+	if(is_start_or_finish_row(row)) {
 		draw_start_or_finish_line(row);
-		term_draw_start_or_finish_line(row); // Do the same for terminal output
 	} else {
-		uint8_t background_row_data = background_data[race_row % NUM_GAME_ROWS];
-		for(i=0;i<=7;i++) {
-			if(background_row_data & (1<<i)) {
-				// Bit i is set, meaning background is present
-				row_display_data[i] = COLOUR_BACKGROUND;
-			} else {
-				row_display_data[i] = COLOUR_BLACK;
-			}
-		}
-		ledmatrix_update_column(15 - row, row_display_data);
-		term_redraw_game_row(row); // Do the same for terminal output
+		gfx_draw_bits(NUM_DISPLAY_ROWS - 1 - row, background_data[race_row % NUM_GAME_ROWS], 0xFF,
+				COLOUR_BACKGROUND, COLOUR_BLACK);
 	}
+	redraw_term_row(row); // Do the same for terminal output
 }
 
 static void draw_start_or_finish_line(uint8_t row) {
-	// Draw a solid line at the given game display row (0 to 15)
-	MatrixColumn row_display_data;
-	uint8_t i;
-	for(i=0;i<=7;i++) {
-		row_display_data[i] = COLOUR_FINISH_LINE;
-	}
-	ledmatrix_update_column(15 - row, row_display_data);
+	// Draw a solid line at the given game display row (0 to NUM_DISPLAY_ROWS - 1)
+	gfx_fill_rect(NUM_DISPLAY_ROWS - 1 - row, 0, 1, MATRIX_NUM_ROWS, COLOUR_FINISH_LINE);
 }
 
-// Redraw the car in its current position.
+// Redraw the car in its current position. (Its two game rows are
+// neighbouring display columns.)
 static void redraw_car(void) {
 	if(has_car_crashed()) {
 		car_colour = COLOUR_CRASH;
 	}
-	ledmatrix_update_pixel(15 - CAR_START_ROW, car_column, car_colour);
-	ledmatrix_update_pixel(15 - (CAR_START_ROW+1), car_column, car_colour);
+	gfx_fill_rect(NUM_DISPLAY_ROWS - 1 - (CAR_START_ROW+1), car_column, 2, 1, car_colour);
 	term_redraw_car(car_colour, car_column); // Do the same for terminal output
 }
 
@@ -385,33 +445,24 @@ static uint8_t check_if_background(uint8_t row, uint8_t column) {
 
 // Erase the car (replace the car position with previous colour)
 static void erase_car(void) {
-	uint8_t bg1, bg2;
-	if(check_if_background(CAR_START_ROW, car_column)) {
-		ledmatrix_update_pixel(15 - CAR_START_ROW, car_column, COLOUR_BACKGROUND);
-		bg1 = 1;
-	} else {
-		ledmatrix_update_pixel(15 - CAR_START_ROW, car_column, COLOUR_BLACK);
-		bg1 = 0;
-	}
+	uint8_t bg1 = check_if_background(CAR_START_ROW, car_column) ? 1 : 0;
+	uint8_t bg2 = check_if_background(CAR_START_ROW+1, car_column) ? 1 : 0;
 
-	if(check_if_background(CAR_START_ROW+1, car_column)) {
-		ledmatrix_update_pixel(15 - (CAR_START_ROW+1), car_column, COLOUR_BACKGROUND);
-		bg2 = 1;
-	} else {
-		ledmatrix_update_pixel(15 - (CAR_START_ROW+1), car_column, COLOUR_BLACK);
-		bg2 = 0;
-	}
+	gfx_draw_bits(NUM_DISPLAY_ROWS - 1 - CAR_START_ROW, get_background_data(CAR_START_ROW),
+			1 << car_column, COLOUR_BACKGROUND, COLOUR_BLACK);
+	gfx_draw_bits(NUM_DISPLAY_ROWS - 1 - (CAR_START_ROW+1), get_background_data(CAR_START_ROW+1),
+			1 << car_column, COLOUR_BACKGROUND, COLOUR_BLACK);
 
 	term_erase_car(bg1, bg2, car_column); // Do the same for terminal output
 }
 
 // Update power-up pixel
 static void redraw_powerup(void) {
-	ledmatrix_update_pixel(15 - powerup_row, powerup_column, powerup_colour);
+	ledmatrix_update_pixel(NUM_DISPLAY_ROWS - 1 - powerup_row, powerup_column, powerup_colour);
 	term_redraw_powerup(powerup_row, powerup_column, powerup_colour); // Do the same for terminal output
 }
 
-// Display power-up pixel iff position reached, within rows 0-15 and power-up not enabled
+// Display power-up pixel iff position reached, within the display and power-up not enabled
 static uint8_t powerup_display(void) {
 	if(scroll_position >= powerup_scroll_position && powerup_row > -1) {
 		disp_powerup = 1;
@@ -423,7 +474,7 @@ static uint8_t powerup_display(void) {
 
 // Helper function to find an empty pixel to place power-up (1 not empty, 0 empty)
 static uint8_t powerup_crashes_at(uint8_t column) {
-	uint8_t background_row_number = (powerup_scroll_position + 15) % NUM_GAME_ROWS;
+	uint8_t background_row_number = (powerup_scroll_position + NUM_DISPLAY_ROWS - 1) % NUM_GAME_ROWS;
 	uint8_t background_row_data = background_data[background_row_number];
 	if(background_row_data & (1<< column)) {
 		// Collision between power-up and background in chosen row
@@ -437,9 +488,11 @@ static uint8_t powerup_crashes_at(uint8_t column) {
 // Helper function to determine the position to place power-up
 static void place_powerup(void) {
 	// We want to place the power-up slightly after the start of a lap
-	// and not too close to finishing line
-	powerup_scroll_position = random() % (RACE_DISTANCE - 60 - 30 + 1) + 30 + scroll_position;
-	powerup_row = 16;
+	// and not too close to finishing line. (It appears at the top of the
+	// display, so a display taller than 16 rows shows it that much sooner.)
+	powerup_scroll_position = random() % (RACE_DISTANCE - 60 - (NUM_DISPLAY_ROWS - 16) - 30 + 1)
+			+ 30 + scroll_position;
+	powerup_row = NUM_DISPLAY_ROWS;
 	// Keep on changing column until power-up does not clash with background
 	do {
 		powerup_column = random() % 7;
@@ -85,9 +85,32 @@ void toggle_car_colour(uint8_t reset);
 // Returns background data at specified row
 uint8_t get_background_data(uint8_t row);
 
+// Returns the scroll position. This goes up by one every time the
+// background scrolls (wrapping around from 255 to 0).
+uint8_t get_scroll_position(void);
+
+// Returns true if the specified row (0 to 15) is the start or finish line
+uint8_t is_start_or_finish_row(uint8_t row);
+
+// Returns the colour the car is currently drawn in
+PixelColour get_car_colour(void);
+
+// Returns the row (0 to LED_DISPLAY_COLUMNS - 1) of the power-up pixel,
+// or -1 if it is not on the display
+int8_t get_powerup_row(void);
+
+// Returns the column of the power-up pixel and the colour it is currently
+// drawn in (it blinks)
+int8_t get_powerup_column(void);
+PixelColour get_powerup_colour(void);
+
 /////////////////////// UPDATE FUNCTIONS /////////////////////////////////////
 // Scroll the background by one row and update the display. Note that this
 // may cause the car to crash.
 void scroll_background(void);
 
+// Clear the terminal and redraw the whole display (background, car and
+// power-up). Used if the terminal output has been switched off.
+void redraw_display(void);
+
 #endif /* GAME_H_ */
\ No newline at end of file
@@ -0,0 +1,127 @@
+/*
+ * gfx.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Everything here works on whole columns. A column word has a 4 bit
+ * palette index for each of the 8 pixels (pixel y in bits 4y to 4y+3), and
+ * a mask word has all 4 bits of a pixel set to pick it out, so
+ *		(old & ~mask) | (new & mask)
+ * changes just the picked pixels in a few instructions however many there
+ * are. Masks are made from a bit per row with a small table, 2 pixels
+ * (one byte) at a time.
+ *
+ * host/gfx_check.c checks these against drawing a pixel at a time - run
+ * it after changing anything here.
+ */
+
+#include <stdint.h>
+
+#include "gfx.h"
+#include "ledmatrix.h"
+
+// Byte of a mask word for 2 bits of a row mask (the low bit is the even
+// row, in the low nibble)
+static const uint8_t pair_mask[4] = { 0x00, 0x0F, 0xF0, 0xFF };
+
+/* Return a column with every pixel set to the palette index for colour.
+ */
+static uint32_t spread(PixelColour colour) {
+	PackedColumn column;
+	uint8_t byte = ledmatrix_palette_index(colour) * 0x11;
+
+	column.bytes[0] = column.bytes[1] = column.bytes[2] = column.bytes[3] = byte;
+	return column.word;
+}
+
+/* Return the mask word for the rows whose bit of bits is set.
+ */
+static uint32_t bits_mask(uint8_t bits) {
+	PackedColumn mask;
+
+	mask.bytes[0] = pair_mask[bits & 0x03];
+	mask.bytes[1] = pair_mask[(bits >> 2) & 0x03];
+	mask.bytes[2] = pair_mask[(bits >> 4) & 0x03];
+	mask.bytes[3] = pair_mask[bits >> 6];
+	return mask.word;
+}
+
+/* Return the mask word for the pixels of column that aren't index 0. Each
+ * nibble's bits are ORed into its lowest bit, which is then spread back
+ * over the nibble (multiplying by 15, with no carries between nibbles).
+ */
+static uint32_t opaque_mask(uint32_t column) {
+	column |= column >> 1;
+	column |= column >> 2;
+	column &= 0x11111111;
+	return (column << 4) - column;
+}
+
+/* Move the bits of a row mask up y rows (down if y is negative).
+ */
+static uint8_t shift_bits(uint8_t bits, int8_t y) {
+	if(y <= -MATRIX_NUM_ROWS || y >= MATRIX_NUM_ROWS) {
+		return 0;
+	}
+	return y >= 0 ? bits << y : bits >> -y;
+}
+
+/* Move the pixels of a column word up y rows (down if y is negative).
+ */
+static uint32_t shift_column(uint32_t column, int8_t y) {
+	if(y <= -MATRIX_NUM_ROWS || y >= MATRIX_NUM_ROWS) {
+		return 0;
+	}
+	return y >= 0 ? column << (4 * y) : column >> (4 * -y);
+}
+
+void gfx_fill_rect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, PixelColour colour) {
+	uint32_t column, mask;
+
+	if(y >= MATRIX_NUM_ROWS || height == 0) {
+		return;
+	}
+	if(height > MATRIX_NUM_ROWS - y) {
+		height = MATRIX_NUM_ROWS - y;
+	}
+	column = spread(colour);
+	mask = bits_mask((uint8_t)(((1 << height) - 1) << y));
+	for(; width > 0 && x < LED_DISPLAY_COLUMNS; width--, x++) {
+		ledmatrix_update_column_masked(x, column, mask);
+	}
+}
+
+void gfx_draw_bits(uint8_t x, uint8_t bits, uint8_t mask, PixelColour set, PixelColour clear) {
+	uint32_t set_mask = bits_mask(bits);
+
+	if(x < LED_DISPLAY_COLUMNS) {
+		ledmatrix_update_column_masked(x, (spread(set) & set_mask) | (spread(clear) & ~set_mask),
+				bits_mask(mask));
+	}
+}
+
+void gfx_draw_bitmap(uint8_t x, int8_t y, const uint8_t* bitmap, uint8_t width,
+		PixelColour colour) {
+	uint32_t column = spread(colour);
+
+	for(; width > 0 && x < LED_DISPLAY_COLUMNS; width--, x++) {
+		ledmatrix_update_column_masked(x, column, bits_mask(shift_bits(*bitmap++, y)));
+	}
+}
+
+void gfx_blit(uint8_t x, int8_t y, const PackedColumn* sprite, const uint8_t* mask,
+		uint8_t width) {
+	for(; width > 0 && x < LED_DISPLAY_COLUMNS; width--, x++) {
+		ledmatrix_update_column_masked(x, shift_column(sprite->word, y),
+				bits_mask(shift_bits(*mask, y)));
+		sprite++;
+		mask++;
+	}
+}
+
+void gfx_overlay(uint8_t x, const PackedColumn* layer, uint8_t width) {
+	for(; width > 0 && x < LED_DISPLAY_COLUMNS; width--, x++) {
+		ledmatrix_update_column_masked(x, layer->word, opaque_mask(layer->word));
+		layer++;
+	}
+}
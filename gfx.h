@@ -0,0 +1,56 @@
+/*
+ * gfx.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Drawing on the LED matrix a column at a time rather than a pixel at a
+ * time. A display column is one 32 bit word of palette indexes in the
+ * LED matrix frame buffer (see PackedColumn in ledmatrix.h), so each of
+ * these works out the new pixels of a column and the pixels to change as
+ * words, and changes them all with one ledmatrix_update_column_masked().
+ *
+ * x is a display column (0 to LED_DISPLAY_COLUMNS - 1) and y a row (0 to
+ * 7). Anything drawn beyond the right of the display or above or below it
+ * is left out. Use these inside an LED matrix frame (see
+ * ledmatrix_begin_frame()) when drawing more than one thing.
+ */
+
+#ifndef GFX_H_
+#define GFX_H_
+
+#include <stdint.h>
+#include "pixel_colour.h"
+#include "ledmatrix.h"
+
+/* Fill a rectangle width columns wide and height rows high, with its
+ * bottom left pixel at (x, y).
+ */
+void gfx_fill_rect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, PixelColour colour);
+
+/* Draw the rows of column x given in mask - in colour set if their bit
+ * of bits is set, otherwise in colour clear. (Bit y is row y.)
+ */
+void gfx_draw_bits(uint8_t x, uint8_t bits, uint8_t mask, PixelColour set, PixelColour clear);
+
+/* Draw a one colour sprite. bitmap has a byte for each of its width
+ * columns, with bit n set where row y + n is drawn (the rest are left as
+ * they are). y can be negative.
+ */
+void gfx_draw_bitmap(uint8_t x, int8_t y, const uint8_t* bitmap, uint8_t width,
+		PixelColour colour);
+
+/* Draw a sprite of any colours. sprite has width columns of palette
+ * indexes (see ledmatrix_palette_index()), and mask has a byte for each
+ * with bit n set where row n of the column is drawn. The sprite's row 0
+ * goes on row y, which can be negative.
+ */
+void gfx_blit(uint8_t x, int8_t y, const PackedColumn* sprite, const uint8_t* mask,
+		uint8_t width);
+
+/* Draw width columns of a layer of palette indexes over the display from
+ * column x. Pixels with index 0 (black) are left out, so what is under
+ * them shows through.
+ */
+void gfx_overlay(uint8_t x, const PackedColumn* layer, uint8_t width);
+
+#endif /* GFX_H_ */
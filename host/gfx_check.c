@@ -0,0 +1,235 @@
+/*
+ * gfx_check.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Host (Linux) check of the column drawing functions in gfx.c. It links
+ * gfx.c against a stand-in for the LED matrix frame buffer (the two
+ * ledmatrix functions gfx.c uses), then does random rectangle fills, bit
+ * and bitmap draws, blits and overlays - including ones that run off the
+ * edges of the display - and after each compares the frame buffer with
+ * the same drawing done a pixel at a time.
+ *
+ * Build:	gcc -std=gnu99 -O2 -I.. -o gfx_check gfx_check.c ../gfx.c
+ * Usage:	gfx_check [-v] [-n count] [-s seed]
+ *
+ * The exit status is 1 if any drawing differed from the pixel at a time
+ * version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ledmatrix.h"
+#include "gfx.h"
+
+#define NUM_OPERATIONS 5
+static const char* const operation_name[NUM_OPERATIONS] = {
+	"fill_rect", "draw_bits", "draw_bitmap", "blit", "overlay"
+};
+
+// Colours drawn with. The stand-in palette gives each its position here as
+// its index (so black is index 0, as in ledmatrix.c).
+static const PixelColour colours[] = {
+	COLOUR_BLACK, COLOUR_RED, COLOUR_GREEN, COLOUR_YELLOW, COLOUR_ORANGE,
+	COLOUR_LIGHT_ORANGE, COLOUR_LIGHT_YELLOW, COLOUR_LIGHT_GREEN
+};
+#define NUM_COLOURS (sizeof(colours) / sizeof(colours[0]))
+
+// The frame buffer gfx.c draws into, and the pixel at a time version
+static PackedColumn display[LED_DISPLAY_COLUMNS];
+static PaletteIndex expected[LED_DISPLAY_COLUMNS][MATRIX_NUM_ROWS];
+static long bad_columns;
+
+/////////////////////// LED matrix stand-in ///////////////////////////
+
+PaletteIndex ledmatrix_palette_index(PixelColour colour) {
+	PaletteIndex index;
+
+	for(index = 0; index < NUM_COLOURS; index++) {
+		if(colours[index] == colour) {
+			return index;
+		}
+	}
+	fprintf(stderr, "Colour %02X not in the palette\n", colour);
+	exit(2);
+}
+
+void ledmatrix_update_column_masked(uint8_t x, uint32_t column, uint32_t mask) {
+	if(x >= LED_DISPLAY_COLUMNS) {
+		// gfx.c should have left this column out
+		printf("  column %d is off the display\n", x);
+		bad_columns++;
+		return;
+	}
+	display[x].word = (display[x].word & ~mask) | (column & mask);
+}
+
+////////////////////// Pixel at a time drawing /////////////////////////
+
+/* Set a pixel of the expected display, unless it is off the display.
+ */
+static void set_expected(int x, int y, PaletteIndex index) {
+	if(x >= 0 && x < LED_DISPLAY_COLUMNS && y >= 0 && y < MATRIX_NUM_ROWS) {
+		expected[x][y] = index;
+	}
+}
+
+/* Return a random colour and (in *index) its palette index.
+ */
+static PixelColour random_colour(PaletteIndex* index) {
+	*index = rand() % NUM_COLOURS;
+	return colours[*index];
+}
+
+/* Do one random operation both ways.
+ */
+static void random_operation(int operation) {
+	// Positions go a little past the right of the display, sprite
+	// rows past the top and bottom
+	uint8_t x = rand() % (LED_DISPLAY_COLUMNS + 3);
+	uint8_t y = rand() % (MATRIX_NUM_ROWS + 1);
+	int8_t sprite_y = rand() % (2 * MATRIX_NUM_ROWS + 1) - MATRIX_NUM_ROWS;
+	uint8_t width = rand() % 6;
+	uint8_t height = rand() % (MATRIX_NUM_ROWS + 2);
+	uint8_t bits[5], mask;
+	PackedColumn sprite[5];
+	PaletteIndex colour_index, clear_index, sprite_index[5][MATRIX_NUM_ROWS];
+	PixelColour colour, clear;
+	int i, j;
+
+	colour = random_colour(&colour_index);
+	clear = random_colour(&clear_index);
+	for(i = 0; i < 5; i++) {
+		bits[i] = rand();
+		sprite[i].word = 0;
+		for(j = 0; j < MATRIX_NUM_ROWS; j++) {
+			random_colour(&sprite_index[i][j]);
+			sprite[i].word |= (uint32_t)sprite_index[i][j] << (4 * j);
+		}
+	}
+
+	switch(operation) {
+		case 0:
+			gfx_fill_rect(x, y, width, height, colour);
+			for(i = 0; i < width; i++) {
+				for(j = 0; j < height; j++) {
+					set_expected(x + i, y + j, colour_index);
+				}
+			}
+			break;
+		case 1:
+			mask = rand();
+			gfx_draw_bits(x, bits[0], mask, colour, clear);
+			for(j = 0; j < MATRIX_NUM_ROWS; j++) {
+				if(mask & (1 << j)) {
+					set_expected(x, j, (bits[0] & (1 << j)) ? colour_index : clear_index);
+				}
+			}
+			break;
+		case 2:
+			gfx_draw_bitmap(x, sprite_y, bits, width, colour);
+			for(i = 0; i < width; i++) {
+				for(j = 0; j < MATRIX_NUM_ROWS; j++) {
+					if(bits[i] & (1 << j)) {
+						set_expected(x + i, sprite_y + j, colour_index);
+					}
+				}
+			}
+			break;
+		case 3:
+			gfx_blit(x, sprite_y, sprite, bits, width);
+			for(i = 0; i < width; i++) {
+				for(j = 0; j < MATRIX_NUM_ROWS; j++) {
+					if(bits[i] & (1 << j)) {
+						set_expected(x + i, sprite_y + j, sprite_index[i][j]);
+					}
+				}
+			}
+			break;
+		case 4:
+			gfx_overlay(x, sprite, width);
+			for(i = 0; i < width; i++) {
+				for(j = 0; j < MATRIX_NUM_ROWS; j++) {
+					if(sprite_index[i][j] != 0) {
+						set_expected(x + i, j, sprite_index[i][j]);
+					}
+				}
+			}
+			break;
+	}
+}
+
+/* Return the number of pixels that differ between the display and the
+ * expected display.
+ */
+static int count_differences(void) {
+	int x, y, differences = 0;
+
+	for(x = 0; x < LED_DISPLAY_COLUMNS; x++) {
+		for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+			if(((display[x].word >> (4 * y)) & 0x0F) != expected[x][y]) {
+				differences++;
+			}
+		}
+	}
+	return differences;
+}
+
+int main(int argc, char** argv) {
+	int opt, verbose = 0, count = 20000, i, x, y, operation, differences;
+	long failures[NUM_OPERATIONS] = { 0 }, runs[NUM_OPERATIONS] = { 0 };
+	long failed = 0;
+	unsigned int seed = 1;
+
+	while((opt = getopt(argc, argv, "vn:s:")) != -1) {
+		switch(opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-v] [-n count] [-s seed]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	srand(seed);
+	for(i = 0; i < count; i++) {
+		operation = rand() % NUM_OPERATIONS;
+		bad_columns = 0;
+		random_operation(operation);
+		differences = count_differences();
+		runs[operation]++;
+		if(differences || bad_columns) {
+			if(failures[operation]++ < 3) {
+				printf("  draw %d (%s) differs in %d pixel(s)\n",
+						i, operation_name[operation], differences);
+			}
+			// Carry on from what gfx.c drew
+			for(x = 0; x < LED_DISPLAY_COLUMNS; x++) {
+				for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+					expected[x][y] = (display[x].word >> (4 * y)) & 0x0F;
+				}
+			}
+		}
+	}
+
+	for(operation = 0; operation < NUM_OPERATIONS; operation++) {
+		if(verbose || failures[operation]) {
+			printf("%-11s %6ld done  %6ld wrong\n", operation_name[operation],
+					runs[operation], failures[operation]);
+		}
+		failed += failures[operation];
+	}
+	printf("%d columns: %s\n", LED_DISPLAY_COLUMNS, failed ? "WRONG" : "ok");
+	return failed != 0;
+}
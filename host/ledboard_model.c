@@ -0,0 +1,210 @@
+/*
+ * ledboard_model.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Host (Linux) stand-in for the LED matrix board's SPI receive buffer, for
+ * checking the timings in ledmatrix_timing.h without the hardware. For
+ * each timing it sends the same bursts of commands as
+ * ledmatrix_self_test() (plus a random mix of commands), paced the same
+ * way ledmatrix.c paces them, and reports the most bytes the board had
+ * waiting and whether any arrived to a full buffer (i.e. were lost).
+ *
+ * The board is modelled as a receive buffer emptied by a main loop that
+ * takes a while over each byte and, once a command is complete, a while
+ * longer to act on it - during which it takes nothing from the buffer. The
+ * figures below are rough - change them (or use -b and -c) to match the
+ * board's firmware.
+ *
+ * Build:	gcc -std=gnu99 -O2 -I.. -o ledboard_model ledboard_model.c
+ * Usage:	ledboard_model [-v] [-b buffer_size] [-c command_number:microseconds]...
+ *
+ * The exit status is 1 if any timing lost a byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ledmatrix_timing.h"
+
+// Board figures (microseconds). Command times are indexed by
+// LED_COMMAND_NUMBER() - all, pixel, row, column, shift, clear.
+#define DEFAULT_BUFFER_SIZE 32
+#define BOARD_BYTE_TIME 3.0
+static double command_time[LED_NUM_COMMANDS] = { 1000, 20, 140, 80, 400, 200 };
+static int buffer_size = DEFAULT_BUFFER_SIZE;
+
+// Time (microseconds) between one byte finishing and the next starting
+// when there is no gap - the SPI interrupt handler on our side
+#define MASTER_TIME 3.0
+
+// Bytes in each command, including the command itself
+static const int command_length[LED_NUM_COMMANDS] = { 129, 3, 18, 10, 2, 1 };
+static const char* const command_name[LED_NUM_COMMANDS] = {
+	"all", "pixel", "row", "column", "shift", "clear"
+};
+
+static const LedTiming timings[LED_NUM_TIMINGS] = LED_TIMINGS;
+
+/* Board state. waiting[] holds the arrival time of each byte in the
+ * buffer and the command number if it is the last byte of a command (-1
+ * otherwise).
+ */
+#define MAX_BUFFER 1024
+static double waiting_time[MAX_BUFFER];
+static int waiting_command[MAX_BUFFER];
+static int waiting_start, waiting_count;
+static double board_free;
+
+// Sender state and results for one run
+static double next_start;
+static int max_waiting;
+static long bytes_sent, bytes_lost;
+
+static void reset(void) {
+	waiting_start = waiting_count = 0;
+	board_free = next_start = 0;
+	max_waiting = 0;
+	bytes_sent = bytes_lost = 0;
+}
+
+/* Let the board take the bytes it gets to before time now.
+ */
+static void run_board(double now) {
+	double taken;
+	int command;
+
+	while(waiting_count > 0) {
+		taken = board_free > waiting_time[waiting_start] ? board_free : waiting_time[waiting_start];
+		if(taken >= now) {
+			return;
+		}
+		command = waiting_command[waiting_start];
+		board_free = taken + BOARD_BYTE_TIME + (command >= 0 ? command_time[command] : 0);
+		waiting_start = (waiting_start + 1) % MAX_BUFFER;
+		waiting_count--;
+	}
+}
+
+/* Send one byte. last is the command number if it is the last byte of a
+ * command, -1 otherwise.
+ */
+static void send_byte(const LedTiming* timing, int last) {
+	double arrival = next_start + timing->divider;	// 8 bits at 8 MHz / divider
+
+	run_board(arrival);
+	bytes_sent++;
+	if(waiting_count >= buffer_size) {
+		bytes_lost++;
+	} else {
+		waiting_time[(waiting_start + waiting_count) % MAX_BUFFER] = arrival;
+		waiting_command[(waiting_start + waiting_count) % MAX_BUFFER] = last;
+		waiting_count++;
+		if(waiting_count > max_waiting) {
+			max_waiting = waiting_count;
+		}
+	}
+	next_start = arrival + MASTER_TIME;
+	if(last >= 0 && timing->gap[last] > MASTER_TIME) {
+		// (ledmatrix.c rounds gaps up to the timer, so they are at least
+		// this long)
+		next_start = arrival + timing->gap[last];
+	}
+}
+
+static void send_command(const LedTiming* timing, int command) {
+	int i;
+
+	for(i = 1; i < command_length[command]; i++) {
+		send_byte(timing, -1);
+	}
+	send_byte(timing, command);
+}
+
+/* The bursts sent by ledmatrix_self_test() for each command.
+ */
+static int burst_count(int command) {
+	switch(command) {
+		case LED_COMMAND_NUMBER(CMD_UPDATE_ALL): return 4;
+		case LED_COMMAND_NUMBER(CMD_UPDATE_PIXEL): return 2 * 128;
+		case LED_COMMAND_NUMBER(CMD_UPDATE_ROW): return 4 * 8;
+		case LED_COMMAND_NUMBER(CMD_UPDATE_COL): return 4 * 16;
+		case LED_COMMAND_NUMBER(CMD_SHIFT_DISPLAY): return 3 * 8 + 4;
+		default: return 32;
+	}
+}
+
+/* Run the timing with one command repeated (or a random mix of commands
+ * if command is -1). Returns non-zero if a byte was lost.
+ */
+static int run(const LedTiming* timing, int command, int verbose) {
+	int i, mixed;
+
+	reset();
+	if(command >= 0) {
+		for(i = burst_count(command); i > 0; i--) {
+			send_command(timing, command);
+		}
+	} else {
+		srand(1);
+		for(i = 0; i < 2000; i++) {
+			// Mostly the cheap commands, as when playing the game
+			mixed = rand() % 16;
+			send_command(timing, mixed < LED_NUM_COMMANDS ? mixed : LED_COMMAND_NUMBER(CMD_UPDATE_PIXEL));
+		}
+	}
+	if(verbose || bytes_lost) {
+		printf("  %-7s %6ld bytes  %7.1f bytes/ms  most waiting %3d  lost %ld\n",
+				command >= 0 ? command_name[command] : "mixed", bytes_sent,
+				bytes_sent * 1000.0 / next_start, max_waiting, bytes_lost);
+	}
+	return bytes_lost != 0;
+}
+
+int main(int argc, char** argv) {
+	int opt, verbose = 0, failed, any_failed = 0;
+	int entry, command;
+	double microseconds;
+
+	while((opt = getopt(argc, argv, "vb:c:")) != -1) {
+		switch(opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'b':
+				buffer_size = atoi(optarg);
+				if(buffer_size < 1 || buffer_size > MAX_BUFFER) {
+					fprintf(stderr, "Buffer size must be 1 to %d\n", MAX_BUFFER);
+					return 2;
+				}
+				break;
+			case 'c':
+				if(sscanf(optarg, "%d:%lf", &command, &microseconds) != 2 ||
+						command < 0 || command >= LED_NUM_COMMANDS) {
+					fprintf(stderr, "Expected command_number:microseconds (0 to %d)\n",
+							LED_NUM_COMMANDS - 1);
+					return 2;
+				}
+				command_time[command] = microseconds;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-v] [-b buffer_size] [-c command_number:microseconds]...\n",
+						argv[0]);
+				return 2;
+		}
+	}
+
+	for(entry = 0; entry < LED_NUM_TIMINGS; entry++) {
+		printf("timing %d (divider %d)\n", entry, timings[entry].divider);
+		failed = 0;
+		for(command = -1; command < LED_NUM_COMMANDS; command++) {
+			failed |= run(&timings[entry], command, verbose);
+		}
+		printf("  %s\n", failed ? "LOSES BYTES" : "ok");
+		any_failed |= failed;
+	}
+	return any_failed;
+}
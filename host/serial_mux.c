@@ -0,0 +1,273 @@
+/*
+ * serial_mux.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Host (Linux) program that separates the channels of multiplexed serial
+ * output (see serialio.h) again. It turns multiplexing on, then
+ * - makes the terminal channel available on a pseudo terminal, so a
+ *   terminal program (e.g. screen or minicom) can be attached to it as if
+ *   it were the board. Keys typed there are passed on to the board.
+ * - makes the telemetry channel available on a second pseudo terminal
+ *   (e.g. for host/telemetry_view)
+ * - writes the debug channel to standard error (or a file), a line at a
+ *   time with a time stamp
+ * - reports replies to host commands
+ * With -r it also tells the board that the terminal supports REP (repeat
+ * the last character), which the board doesn't use otherwise.
+ * On exit (Ctrl-C) multiplexing is turned off again and the number of
+ * bytes seen on each channel is shown.
+ *
+ * Build:	gcc -std=gnu99 -O2 -I.. -o serial_mux serial_mux.c
+ * Usage:	serial_mux [-r] [-b baud] [-d debug_file] device
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "serialio.h"
+
+static volatile sig_atomic_t finished = 0;
+
+// Receive state
+static uint8_t channel = SERIAL_CHANNEL_TERMINAL;
+static int escape_seen = 0;
+static unsigned long channel_bytes[SERIAL_NUM_CHANNELS];
+static unsigned long bad_tags;
+
+// Where channel output goes
+static int terminal_fd, telemetry_fd;
+static FILE* debug_file;
+static char debug_line[256];
+static size_t debug_length;
+
+static void handle_signal(int sig) {
+	(void)sig;
+	finished = 1;
+}
+
+static speed_t baud_constant(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 500000: return B500000;
+		case 1000000: return B1000000;
+		default: return 0;
+	}
+}
+
+static int open_serial(const char* device, long baud) {
+	struct termios tio;
+	speed_t speed = baud_constant(baud);
+	int fd;
+
+	if(!speed) {
+		fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+		return -1;
+	}
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if(fd < 0) {
+		perror(device);
+		return -1;
+	}
+	if(tcgetattr(fd, &tio) < 0) {
+		perror("tcgetattr");
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &tio) < 0) {
+		perror("tcsetattr");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Create a pseudo terminal in raw mode and return the master side. The
+ * slave side is kept open so that writes don't fail while nothing is
+ * attached to it.
+ */
+static int open_pty(const char* name) {
+	struct termios tio;
+	int master, slave;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if(slave < 0) {
+		perror(ptsname(master));
+		return -1;
+	}
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	fcntl(master, F_SETFL, O_NONBLOCK);
+	fprintf(stderr, "%s channel: %s\n", name, ptsname(master));
+	return master;
+}
+
+static void debug_byte(uint8_t c) {
+	struct timeval now;
+
+	if(c != '\n' && debug_length < sizeof(debug_line) - 1) {
+		debug_line[debug_length++] = c;
+		return;
+	}
+	debug_line[debug_length] = '\0';
+	gettimeofday(&now, NULL);
+	fprintf(debug_file, "[%ld.%03ld] %s\n", (long)now.tv_sec, (long)now.tv_usec / 1000,
+			debug_line);
+	fflush(debug_file);
+	debug_length = 0;
+	if(c != '\n') {
+		debug_byte(c);
+	}
+}
+
+/* Pass a data byte on to wherever its channel goes. Output to a pseudo
+ * terminal that nobody is reading is thrown away once its buffer fills.
+ */
+static void channel_byte(uint8_t c) {
+	channel_bytes[channel]++;
+	switch(channel) {
+		case SERIAL_CHANNEL_TERMINAL:
+			(void)write(terminal_fd, &c, 1);
+			break;
+		case SERIAL_CHANNEL_TELEMETRY:
+			(void)write(telemetry_fd, &c, 1);
+			break;
+		case SERIAL_CHANNEL_DEBUG:
+			debug_byte(c);
+			break;
+		case SERIAL_CHANNEL_COMMAND:
+			fprintf(stderr, "command reply: %s\n",
+					c == HOST_REPLY_ACK ? "ACK" : (c == HOST_REPLY_NAK ? "NAK" : "?"));
+			break;
+	}
+}
+
+static void receive_byte(uint8_t c) {
+	if(escape_seen) {
+		escape_seen = 0;
+		if(c == SERIAL_MUX_ESCAPE) {
+			channel_byte(c);
+		} else if(c >= '0' && c < '0' + SERIAL_NUM_CHANNELS) {
+			channel = c - '0';
+		} else {
+			bad_tags++;
+		}
+	} else if(c == SERIAL_MUX_ESCAPE) {
+		escape_seen = 1;
+	} else {
+		channel_byte(c);
+	}
+}
+
+static void send_command(int fd, char command, char argument) {
+	const char bytes[3] = { HOST_COMMAND_CHAR, command, argument };
+
+	if(write(fd, bytes, sizeof(bytes)) != sizeof(bytes)) {
+		perror("write");
+	}
+}
+
+int main(int argc, char** argv) {
+	long baud = 19200;
+	uint8_t buffer[256];
+	ssize_t count, i;
+	fd_set fds;
+	int fd, opt, max_fd;
+	int repeat = 0;
+
+	debug_file = stderr;
+	while((opt = getopt(argc, argv, "rb:d:")) != -1) {
+		switch(opt) {
+			case 'r':
+				repeat = 1;
+				break;
+			case 'b':
+				baud = atol(optarg);
+				break;
+			case 'd':
+				debug_file = fopen(optarg, "a");
+				if(!debug_file) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-r] [-b baud] [-d debug_file] device\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc) {
+		fprintf(stderr, "Usage: %s [-r] [-b baud] [-d debug_file] device\n", argv[0]);
+		return 1;
+	}
+
+	fd = open_serial(argv[optind], baud);
+	terminal_fd = open_pty("terminal");
+	telemetry_fd = open_pty("telemetry");
+	if(fd < 0 || terminal_fd < 0 || telemetry_fd < 0) {
+		return 1;
+	}
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	send_command(fd, HOST_COMMAND_MULTIPLEX, '1');
+	if(repeat) {
+		send_command(fd, HOST_COMMAND_REPEAT, '1');
+	}
+
+	max_fd = fd > terminal_fd ? fd : terminal_fd;
+	while(!finished) {
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		FD_SET(terminal_fd, &fds);
+		if(select(max_fd + 1, &fds, NULL, NULL, NULL) < 0) {
+			continue;	// Interrupted by a signal
+		}
+		if(FD_ISSET(fd, &fds)) {
+			count = read(fd, buffer, sizeof(buffer));
+			if(count <= 0) {
+				break;
+			}
+			for(i = 0; i < count; i++) {
+				receive_byte(buffer[i]);
+			}
+		}
+		if(FD_ISSET(terminal_fd, &fds)) {
+			// Keys typed in the attached terminal go to the board
+			count = read(terminal_fd, buffer, sizeof(buffer));
+			if(count > 0 && write(fd, buffer, count) != count) {
+				perror("write");
+			}
+		}
+	}
+
+	send_command(fd, HOST_COMMAND_MULTIPLEX, '0');
+	fprintf(stderr, "\nbytes: terminal %lu, telemetry %lu, debug %lu, command %lu, bad tags %lu\n",
+			channel_bytes[SERIAL_CHANNEL_TERMINAL], channel_bytes[SERIAL_CHANNEL_TELEMETRY],
+			channel_bytes[SERIAL_CHANNEL_DEBUG], channel_bytes[SERIAL_CHANNEL_COMMAND], bad_tags);
+	return 0;
+}
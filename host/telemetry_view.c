@@ -0,0 +1,298 @@
+/*
+ * telemetry_view.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Host (Linux) program that draws the game from the binary telemetry
+ * frames sent by the board (see telemetry.h) rather than from escape
+ * sequences.
+ *
+ * Build:	gcc -std=gnu99 -O2 -I.. -o telemetry_view telemetry_view.c
+ * Usage:	telemetry_view [-s] [-b baud] device
+ *			telemetry_view - < captured_output
+ *
+ * -s sends the host command that switches the board to telemetry output.
+ * Bytes that are not part of a valid frame (e.g. terminal output sent
+ * before telemetry mode was switched on) are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "telemetry.h"
+#include "serialio.h"
+
+#define NUM_COLUMNS 8
+
+// Receive state
+enum {
+	WAIT_SYNC, WAIT_TYPE, WAIT_SEQUENCE, WAIT_LENGTH, WAIT_PAYLOAD, WAIT_CHECK
+};
+
+static int rx_state = WAIT_SYNC;
+static uint8_t rx_type, rx_sequence, rx_length, rx_count, rx_check;
+static uint8_t rx_payload[256];
+
+// Game as last received. Row 0 is the bottom row (the car is on rows 1
+// and 2).
+static uint8_t background[TELEMETRY_NUM_ROWS];
+static uint8_t line_row[TELEMETRY_NUM_ROWS];
+static uint8_t state[TELEMETRY_STATE_LENGTH];
+static int have_playfield = 0;
+
+// Link statistics
+static unsigned long frames_good, frames_bad, frames_missed;
+static int have_sequence = 0;
+static uint8_t expected_sequence;
+
+/* CRC-8, polynomial 0x07 - the same as _crc8_ccitt_update() on the board.
+ */
+static uint8_t crc8_update(uint8_t crc, uint8_t data) {
+	int i;
+
+	crc ^= data;
+	for(i = 0; i < 8; i++) {
+		if(crc & 0x80) {
+			crc = (crc << 1) ^ 0x07;
+		} else {
+			crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+static speed_t baud_constant(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 500000: return B500000;
+		case 1000000: return B1000000;
+		default: return 0;
+	}
+}
+
+static int open_serial(const char* device, long baud) {
+	struct termios tio;
+	speed_t speed = baud_constant(baud);
+	int fd;
+
+	if(!speed) {
+		fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+		return -1;
+	}
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if(fd < 0) {
+		perror(device);
+		return -1;
+	}
+	if(tcgetattr(fd, &tio) < 0) {
+		perror("tcgetattr");
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &tio) < 0) {
+		perror("tcsetattr");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void draw(void) {
+	int row, column;
+	uint8_t flags = state[1];
+	int8_t powerup_row = (int8_t)state[2];
+	uint32_t score = state[6] | (state[7] << 8) | (state[8] << 16) | ((uint32_t)state[9] << 24);
+	uint16_t lap_time = state[10] | (state[11] << 8);
+
+	if(!have_playfield) {
+		return;
+	}
+	printf("\033[H");
+	printf("Level %d   Lives %d   Score %lu   Lap %u.%u s   %s%s\033[K\n\n",
+			state[5], state[4], (unsigned long)score, lap_time / 10, lap_time % 10,
+			(flags & TELEMETRY_FLAG_PAUSED) ? "PAUSED " : "",
+			(flags & TELEMETRY_FLAG_CRASHED) ? "CRASHED" : "");
+	for(row = TELEMETRY_NUM_ROWS - 1; row >= 0; row--) {
+		printf("  ");
+		for(column = 0; column < NUM_COLUMNS; column++) {
+			if((row == 1 || row == 2) && column == state[0]) {
+				if(flags & TELEMETRY_FLAG_CRASHED) {
+					printf("\033[41m  ");
+				} else if(flags & TELEMETRY_FLAG_CAR_LIT) {
+					printf("\033[42m  ");
+				} else {
+					printf("\033[43m  ");
+				}
+			} else if(row == powerup_row && column == state[3]) {
+				printf((flags & TELEMETRY_FLAG_POWERUP_LIT) ? "\033[42m  " : "\033[40m  ");
+			} else if(background[row] & (1 << column)) {
+				printf("\033[44m  ");
+			} else if(line_row[row]) {
+				printf("\033[47m  ");
+			} else {
+				printf("\033[40m  ");
+			}
+		}
+		printf("\033[0m\n");
+	}
+	printf("\nframes %lu  bad %lu  missed %lu\033[K\n", frames_good, frames_bad, frames_missed);
+	fflush(stdout);
+}
+
+/* Act on a frame that has passed its check.
+ */
+static void handle_frame(void) {
+	uint8_t* block;
+	int row;
+
+	if(have_sequence && rx_sequence != expected_sequence) {
+		frames_missed += (uint8_t)(rx_sequence - expected_sequence);
+	}
+	have_sequence = 1;
+	expected_sequence = rx_sequence + 1;
+
+	switch(rx_type) {
+		case TELEMETRY_FRAME_FULL:
+			if(rx_length != TELEMETRY_NUM_ROWS + 2 + TELEMETRY_STATE_LENGTH) {
+				frames_bad++;
+				return;
+			}
+			for(row = 0; row < TELEMETRY_NUM_ROWS; row++) {
+				background[row] = rx_payload[row];
+				line_row[row] = ((rx_payload[TELEMETRY_NUM_ROWS]
+						| (rx_payload[TELEMETRY_NUM_ROWS + 1] << 8)) >> row) & 1;
+			}
+			block = &rx_payload[TELEMETRY_NUM_ROWS + 2];
+			have_playfield = 1;
+			break;
+		case TELEMETRY_FRAME_SCROLL:
+			if(rx_length != 2 + TELEMETRY_STATE_LENGTH) {
+				frames_bad++;
+				return;
+			}
+			memmove(&background[0], &background[1], TELEMETRY_NUM_ROWS - 1);
+			memmove(&line_row[0], &line_row[1], TELEMETRY_NUM_ROWS - 1);
+			background[TELEMETRY_NUM_ROWS - 1] = rx_payload[0];
+			line_row[TELEMETRY_NUM_ROWS - 1] = rx_payload[1];
+			block = &rx_payload[2];
+			break;
+		case TELEMETRY_FRAME_STATE:
+			if(rx_length != TELEMETRY_STATE_LENGTH) {
+				frames_bad++;
+				return;
+			}
+			block = rx_payload;
+			break;
+		default:
+			// Unknown frame type - ignore it
+			return;
+	}
+	memcpy(state, block, TELEMETRY_STATE_LENGTH);
+	frames_good++;
+	draw();
+}
+
+static void receive_byte(uint8_t c) {
+	switch(rx_state) {
+		case WAIT_SYNC:
+			if(c == TELEMETRY_SYNC) {
+				rx_state = WAIT_TYPE;
+				rx_check = 0;
+			}
+			return;
+		case WAIT_TYPE:
+			rx_type = c;
+			rx_state = WAIT_SEQUENCE;
+			break;
+		case WAIT_SEQUENCE:
+			rx_sequence = c;
+			rx_state = WAIT_LENGTH;
+			break;
+		case WAIT_LENGTH:
+			rx_length = c;
+			rx_count = 0;
+			if(rx_length > TELEMETRY_MAX_PAYLOAD) {
+				// Can't be a frame - look for the next sync byte
+				rx_state = WAIT_SYNC;
+				return;
+			}
+			rx_state = rx_length ? WAIT_PAYLOAD : WAIT_CHECK;
+			break;
+		case WAIT_PAYLOAD:
+			rx_payload[rx_count++] = c;
+			if(rx_count == rx_length) {
+				rx_state = WAIT_CHECK;
+			}
+			break;
+		case WAIT_CHECK:
+			rx_state = WAIT_SYNC;
+			if(c == rx_check) {
+				handle_frame();
+			} else {
+				frames_bad++;
+			}
+			return;
+	}
+	rx_check = crc8_update(rx_check, c);
+}
+
+int main(int argc, char** argv) {
+	long baud = 19200;
+	int switch_mode = 0;
+	uint8_t buffer[256];
+	ssize_t count, i;
+	int fd, opt;
+
+	while((opt = getopt(argc, argv, "sb:")) != -1) {
+		switch(opt) {
+			case 's': switch_mode = 1; break;
+			case 'b': baud = atol(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-s] [-b baud] device|-\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc) {
+		fprintf(stderr, "Usage: %s [-s] [-b baud] device|-\n", argv[0]);
+		return 1;
+	}
+
+	if(strcmp(argv[optind], "-") == 0) {
+		fd = STDIN_FILENO;
+	} else {
+		fd = open_serial(argv[optind], baud);
+		if(fd < 0) {
+			return 1;
+		}
+		if(switch_mode) {
+			const char command[3] = { HOST_COMMAND_CHAR, HOST_COMMAND_OUTPUT_MODE, '1' };
+			if(write(fd, command, sizeof(command)) != sizeof(command)) {
+				perror("write");
+			}
+		}
+	}
+
+	printf("\033[2J\033[?25l");
+	while((count = read(fd, buffer, sizeof(buffer))) > 0) {
+		for(i = 0; i < count; i++) {
+			receive_byte(buffer[i]);
+		}
+	}
+	printf("\033[?25h\n");
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * hud.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * HUD widgets (see hud.h). Values are formatted into a buffer (see
+ * textout.h) so each one can be compared a character at a time with what
+ * the terminal shows.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "hud.h"
+#include "terminalio.h"
+#include "serialio.h"
+#include "telemetry.h"
+#include "textout.h"
+#include "messages.h"
+
+/* Widgets */
+#define HUD_LEVEL 0
+#define HUD_LIVES 1
+#define HUD_SCORE 2
+#define HUD_LAP_TIME 3
+#define HUD_PAUSED 4
+#define HUD_NUM_WIDGETS 5
+
+/* Where each widget is on the terminal, how many characters it takes up
+ * (shorter values are padded with spaces), its colour and attributes,
+ * and where its characters start in shown[].
+ */
+typedef struct {
+	int8_t x, y;
+	uint8_t width;
+	uint8_t foreground;
+	uint16_t flags;
+	uint8_t offset;
+} HudWidget;
+
+static const HudWidget widgets[HUD_NUM_WIDGETS] PROGMEM = {
+	{ 36, 2, 1, FG_YELLOW, 0, 0 },					// "Level n"
+	{ 37, 3, 1, FG_DEFAULT, 0, 1 },					// "Lives: n"
+	{ 37, 4, 10, FG_DEFAULT, 0, 2 },				// "Score: n"
+	{ 40, 5, 16, FG_DEFAULT, 0, 12 },				// "Lap Time: n.n second(s)"
+	{ 36, 6, 9, FG_MAGENTA, STYLE(TERM_BRIGHT), 28 }	// "Paused..."
+};
+
+// The characters the terminal is showing for each widget
+#define SHOWN_LENGTH 37
+static char shown[SHOWN_LENGTH];
+
+// Longest value text
+#define MAX_WIDTH 16
+
+/* Show text (length characters) in a widget, sending only the characters
+ * that have changed. Changed characters next to each other are sent
+ * together.
+ */
+static void render(uint8_t widget, const char* text, uint8_t length) {
+	const HudWidget* layout = &widgets[widget];
+	int8_t x = pgm_read_byte(&layout->x);
+	int8_t y = pgm_read_byte(&layout->y);
+	uint8_t width = pgm_read_byte(&layout->width);
+	char* current = &shown[pgm_read_byte(&layout->offset)];
+	uint8_t styled = 0;
+	uint8_t i;
+	char c;
+
+	if(telemetry_mode() == TELEMETRY_ONLY) {
+		return;
+	}
+	for(i = 0; i < width; i++) {
+		c = i < length ? text[i] : ' ';
+		if(c == current[i]) {
+			continue;
+		}
+		if(!styled) {
+			set_text_style(pgm_read_byte(&layout->foreground), BG_DEFAULT,
+					pgm_read_word(&layout->flags));
+			styled = 1;
+		}
+		// (Costs nothing if the cursor is already there after the last
+		// changed character)
+		move_cursor(x + i, y);
+		putchar(c);
+		cursor_advanced(1);
+		current[i] = c;
+	}
+	if(styled) {
+		normal_display_mode();
+	}
+}
+
+void hud_draw(void) {
+	if(telemetry_mode() == TELEMETRY_ONLY) {
+		return;
+	}
+	set_display_attribute(FG_YELLOW);
+	move_cursor(30,2);
+	put_message(MSG_LEVEL);
+	normal_display_mode();
+	move_cursor(30,3);
+	put_message(MSG_LIVES);
+	move_cursor(30,4);
+	put_message(MSG_SCORE);
+	move_cursor(30,5);
+	put_message(MSG_LAP_TIME);
+	memset(shown, ' ', SHOWN_LENGTH);
+}
+
+void hud_set_level(uint8_t level) {
+	char text[MAX_WIDTH];
+	render(HUD_LEVEL, text, format_unsigned(text, level));
+}
+
+void hud_set_lives(uint8_t lives) {
+	char text[MAX_WIDTH];
+	render(HUD_LIVES, text, format_unsigned(text, lives));
+}
+
+void hud_set_score(uint32_t score) {
+	char text[MAX_WIDTH];
+	render(HUD_SCORE, text, format_unsigned(text, score));
+}
+
+void hud_set_lap_time(uint16_t tenths) {
+	char text[MAX_WIDTH];
+	uint8_t length = format_tenths(text, tenths);
+
+	length += message_copy(&text[length], MSG_SECONDS);
+	render(HUD_LAP_TIME, text, length);
+}
+
+void hud_set_paused(uint8_t paused) {
+	char text[MAX_WIDTH];
+	uint8_t length = message_copy(text, MSG_PAUSED);
+
+	render(HUD_PAUSED, text, paused ? length : 0);
+}
@@ -0,0 +1,33 @@
+/*
+ * hud.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Heads-up display on the terminal (level, lives, score, lap time and
+ * pause message). Each value is a widget that remembers the characters
+ * the terminal is showing for it, so setting a value only sends the
+ * characters that changed - usually just the last digit or two.
+ * Nothing is sent in the TELEMETRY_ONLY mode (see telemetry.h).
+ */
+
+#ifndef HUD_H_
+#define HUD_H_
+
+#include <stdint.h>
+
+/* Draw the HUD labels. Must be called after the terminal has been
+ * cleared (every value is then taken to be blank), and followed by
+ * setting each value.
+ */
+void hud_draw(void);
+
+/* Set the value a widget shows. Only characters that differ from what
+ * the terminal shows are sent.
+ */
+void hud_set_level(uint8_t level);
+void hud_set_lives(uint8_t lives);
+void hud_set_score(uint32_t score);
+void hud_set_lap_time(uint16_t tenths);
+void hud_set_paused(uint8_t paused);
+
+#endif /* HUD_H_ */
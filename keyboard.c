@@ -0,0 +1,177 @@
+/*
+ * keyboard.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Escape sequence decoder (see keyboard.h). The sequences we recognise
+ * are listed in a table in program memory, so adding a key only needs a
+ * new table entry.
+ */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "keyboard.h"
+#include "terminalio.h"
+
+/* Decoder states */
+#define STATE_GROUND 0		// Not in an escape sequence
+#define STATE_ESCAPE 1		// Had ESC
+#define STATE_CSI 2			// Had ESC [ (and maybe some parameters)
+#define STATE_SS3 3			// Had ESC O
+
+/* Known sequences. final is the last character of the sequence. For
+ * ESC [ sequences, parameter is the first number in the sequence, 0 if
+ * there isn't one (e.g. ESC [ 4 ~ has parameter 4). Entries with
+ * ANY_PARAMETER match whatever the parameter is (e.g. ESC [ 1 ; 5 A,
+ * which is Ctrl-Up on some terminals, is treated as Up).
+ */
+#define ANY_PARAMETER 0xFF
+
+typedef struct {
+	char final;
+	uint8_t parameter;
+	uint8_t key;
+} KeySequence;
+
+static const KeySequence csi_sequences[] PROGMEM = {
+	{ 'A', ANY_PARAMETER, KEY_UP },
+	{ 'B', ANY_PARAMETER, KEY_DOWN },
+	{ 'C', ANY_PARAMETER, KEY_RIGHT },
+	{ 'D', ANY_PARAMETER, KEY_LEFT },
+	{ 'H', ANY_PARAMETER, KEY_HOME },
+	{ 'F', ANY_PARAMETER, KEY_END },
+	{ '~', 1, KEY_HOME },
+	{ '~', 4, KEY_END },
+	{ '~', 7, KEY_HOME },
+	{ '~', 8, KEY_END },
+	{ 0, 0, KEY_NONE }
+};
+
+static const KeySequence ss3_sequences[] PROGMEM = {
+	{ 'A', ANY_PARAMETER, KEY_UP },
+	{ 'B', ANY_PARAMETER, KEY_DOWN },
+	{ 'C', ANY_PARAMETER, KEY_RIGHT },
+	{ 'D', ANY_PARAMETER, KEY_LEFT },
+	{ 'H', ANY_PARAMETER, KEY_HOME },
+	{ 'F', ANY_PARAMETER, KEY_END },
+	{ 'M', ANY_PARAMETER, KEY_ENTER },	// Keypad Enter
+	{ 0, 0, KEY_NONE }
+};
+
+// Decoder state, the parameter collected so far (and whether we have
+// finished collecting it), whether the ESC [ sequence started with ?, and
+// milliseconds since the last character
+static uint8_t state = STATE_GROUND;
+static uint8_t parameter;
+static uint8_t parameter_done;
+static uint8_t private_sequence;
+static uint8_t idle_time;
+
+// Whether the last character was a carriage return (an LF straight after
+// one is part of the same Enter)
+static uint8_t after_return;
+
+/* Look up the key for a sequence in one of the tables above.
+ */
+static uint8_t find_key(const KeySequence* table, char final, uint8_t param) {
+	char table_final;
+	uint8_t table_param;
+
+	while((table_final = pgm_read_byte(&table->final)) != 0) {
+		table_param = pgm_read_byte(&table->parameter);
+		if(table_final == final && (table_param == ANY_PARAMETER || table_param == param)) {
+			return pgm_read_byte(&table->key);
+		}
+		table++;
+	}
+	return KEY_NONE;
+}
+
+uint8_t key_decode(uint8_t c) {
+	uint8_t was_return = after_return;
+
+	idle_time = 0;
+	after_return = 0;
+
+	switch(state) {
+		case STATE_ESCAPE:
+			if(c == '[') {
+				state = STATE_CSI;
+				parameter = 0;
+				parameter_done = 0;
+				private_sequence = 0;
+				return KEY_NONE;
+			} else if(c == 'O') {
+				state = STATE_SS3;
+				return KEY_NONE;
+			} else if(c == KEY_ESCAPE) {
+				// ESC ESC - the first one was a lone ESC
+				return KEY_ESCAPE;
+			}
+			// ESC then an ordinary character (e.g. Alt + key) - just
+			// use the character
+			state = STATE_GROUND;
+			break;
+		case STATE_CSI:
+			if(c >= '0' && c <= '9') {
+				if(!parameter_done && parameter < 25) {
+					parameter = parameter * 10 + (c - '0');
+				}
+				return KEY_NONE;
+			} else if(c == '?' && parameter == 0 && !parameter_done) {
+				private_sequence = 1;
+				return KEY_NONE;
+			} else if(c >= 0x20 && c <= 0x3F) {
+				// Separator or other parameter character. Only the
+				// first parameter is used.
+				parameter_done = 1;
+				return KEY_NONE;
+			}
+			state = STATE_GROUND;
+			if(private_sequence && c == 'c') {
+				// Device Attributes reply (ESC [ ? level ; features c),
+				// not a key
+				set_terminal_level(parameter);
+				return KEY_NONE;
+			} else if(c >= 0x40 && c <= 0x7E) {
+				// Final character
+				return find_key(csi_sequences, c, parameter);
+			}
+			// Not a valid sequence - drop it and use the character
+			break;
+		case STATE_SS3:
+			state = STATE_GROUND;
+			return find_key(ss3_sequences, c, 0);
+	}
+
+	if(c == KEY_ESCAPE) {
+		state = STATE_ESCAPE;
+		return KEY_NONE;
+	} else if(c == '\r') {
+		after_return = 1;
+		return KEY_ENTER;
+	} else if(c == '\n' && was_return) {
+		// CR LF - already reported as Enter
+		return KEY_NONE;
+	} else if(c == '\b') {
+		return KEY_BACKSPACE;
+	} else if(c >= KEY_UP && c <= KEY_END) {
+		// Would be mistaken for a cursor key
+		return KEY_NONE;
+	}
+	return c;
+}
+
+uint8_t key_decode_tick(void) {
+	if(state == STATE_GROUND || ++idle_time < KEY_ESCAPE_TIMEOUT) {
+		return KEY_NONE;
+	}
+	// Timed out - abandon the sequence
+	if(state == STATE_ESCAPE) {
+		state = STATE_GROUND;
+		return KEY_ESCAPE;
+	}
+	state = STATE_GROUND;
+	return KEY_NONE;
+}
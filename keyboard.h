@@ -0,0 +1,56 @@
+/*
+ * keyboard.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Decoder that turns the characters typed at the terminal into key
+ * codes. Ordinary characters are passed through unchanged (so 'a', 'W',
+ * 'p' etc. are their own key codes), Enter and Backspace are given one
+ * code each whatever the terminal sends for them (CR LF is one Enter),
+ * and the escape sequences sent by the cursor keys (both the ESC [ and
+ * ESC O forms) are turned into single KEY_ codes. The serial receive
+ * interrupt handler
+ * runs every character through this decoder, so only key codes ever
+ * reach the input buffer (see serial_get_key() in serialio.h).
+ * Characters with the same values as the KEY_ codes of the cursor keys
+ * (KEY_UP to KEY_END) are ignored rather than mistaken for them.
+ *
+ * A partial escape sequence that is not completed within
+ * KEY_ESCAPE_TIMEOUT milliseconds is abandoned. A lone ESC is then
+ * reported as KEY_ESCAPE.
+ *
+ * The terminal's reply to a Device Attributes request is not a key - it is
+ * passed to set_terminal_level() in terminalio.h instead.
+ */
+
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdint.h>
+
+#define KEY_NONE 0			// No key (yet)
+#define KEY_ENTER '\n'
+#define KEY_BACKSPACE 127
+#define KEY_ESCAPE 27
+#define KEY_UP 0x80
+#define KEY_DOWN 0x81
+#define KEY_RIGHT 0x82
+#define KEY_LEFT 0x83
+#define KEY_HOME 0x84
+#define KEY_END 0x85
+
+// Time allowed between the characters of an escape sequence (ms)
+#define KEY_ESCAPE_TIMEOUT 50
+
+/* Decode the next received character. Returns the key code if it
+ * completes a key, or KEY_NONE if it is part of an escape sequence (or an
+ * escape sequence we don't recognise).
+ */
+uint8_t key_decode(uint8_t c);
+
+/* Must be called every millisecond. Returns KEY_ESCAPE if a lone ESC has
+ * just timed out, KEY_NONE otherwise.
+ */
+uint8_t key_decode_tick(void);
+
+#endif /* KEYBOARD_H_ */
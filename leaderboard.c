@@ -20,6 +20,9 @@
 #include "terminalio.h"
 #include "score.h"
 #include "leaderboard.h"
+#include "keyboard.h"
+#include "textout.h"
+#include "messages.h"
 
 // Memory address of stored variable in EEPROM
 static Highscore EEMEM scores[MAX_NUM];
@@ -80,32 +83,24 @@ static char* get_initials(void) {
 	// Initialise empty name at first
 	char tmp[6];
 	memset(tmp, 0, 6);
-	char input;
+	uint8_t key;
 	uint8_t pos = 0;
-	uint8_t escape_seq = 0;
 	clear_serial_input_buffer();
 
 	while(1) {
-		// Part of code adapted from project.c to ignore escape sequences
-		if(serial_input_available()) {
-			input = fgetc(stdin);
-			if(input == '\n') {
+		// Escape sequences have already been decoded into single key
+		// codes, so anything other than letters, Enter and Backspace is
+		// just ignored
+		key = serial_get_key();
+		if(key != KEY_NONE) {
+			if(key == KEY_ENTER) {
 				// Enter key pressed, save name
 				break;
-			} else if(escape_seq == 0 && input == ESCAPE_CHAR) {
-				// We've hit the first character in an escape sequence (escape)
-				escape_seq++;
-			} else if(escape_seq == 1 && (input == '[' || input == 'O')) {
-				// We've hit the second character in an escape sequence
-				escape_seq++;
-			} else if(escape_seq == 2) {
-				// Third (and last) character in the escape sequence
-				escape_seq = 0;
-			} else if(isalpha(input) && pos < 5) {
+			} else if(key < 0x80 && isalpha(key) && pos < 5) {
 				// Only alphabets are valid, maximum of 5 characters
-				tmp[pos] = input;
+				tmp[pos] = key;
 				pos++;
-			} else if(input == BACK_SPACE) {
+			} else if(key == KEY_BACKSPACE) {
 				// Backspace key pressed, clear previous character
 				if(pos > 0) {
 					pos--;
@@ -116,7 +111,8 @@ static char* get_initials(void) {
 			}
 			// Redisplay updated name variable
 			move_cursor(38, 15);
-			printf_P(PSTR("%-5s"), tmp);
+			fputs(tmp, stdout);
+			put_spaces(5 - strlen(tmp));
 			move_cursor(38+pos, 15);
 		}
 	}
@@ -139,14 +135,14 @@ void is_highscore(void) {
 		clear_terminal();
 		set_display_attribute(FG_GREEN);
 		move_cursor(32,8);
-		printf_P(PSTR("CONGRATULATIONS!"));
+		put_message(MSG_CONGRATULATIONS);
 		normal_display_mode();
 		move_cursor(28,10);
-		printf_P(PSTR("You got a new high score!"));
+		put_message(MSG_NEW_HIGH_SCORE);
 		move_cursor(23,12);
-		printf_P(PSTR("Please enter your initials (max 5)"));
+		put_message(MSG_ENTER_INITIALS);
 		move_cursor(30,13);
-		printf_P(PSTR("Press enter to save:"));
+		put_message(MSG_PRESS_ENTER);
 
 		// Read from stdin
 		move_cursor(38,15);
@@ -165,23 +161,34 @@ void leaderboard_terminal_output(void) {
 	// Pretty printing of leader board
 	draw_horizontal_line(15, 0, 79);
 	move_cursor(34,16);
-	set_display_attribute(FG_YELLOW);
-	set_display_attribute(TERM_UNDERSCORE);
-	printf_P(PSTR("LEADER BOARD"));
+	set_text_style(FG_YELLOW, BG_DEFAULT, STYLE(TERM_UNDERSCORE));
+	put_message(MSG_LEADER_BOARD);
 	normal_display_mode();
 	move_cursor(29,18);
 	set_display_attribute(FG_YELLOW);
-	printf_P(PSTR("Name      ->     Score"));
+	put_message(MSG_LEADER_BOARD_HEADING);
 	normal_display_mode();
 
 	uint8_t i;
 	for(i=0;i<MAX_NUM;i++) {
 		if(current_score[i].signature == SIGNATURE) {
 			move_cursor(26,19+i);
-			printf_P(PSTR("%d. %-5s     ->     %ld"), i+1, current_score[i].name, current_score[i].score);
+			put_unsigned(i+1);
+			putchar('.');
+			putchar(' ');
+			// Names are at most 5 characters and only change once this
+			// output has long been sent, so they can be sent straight
+			// from RAM.
+			uint8_t length = strlen(current_score[i].name);
+			serial_put_ram(current_score[i].name, length);
+			put_spaces(10 - length);
+			put_message(MSG_ARROW);
+			put_spaces(5);
+			put_unsigned(current_score[i].score);
 		} else {
 			move_cursor(26,19+i);
-			printf_P(PSTR("%d."), i+1);
+			put_unsigned(i+1);
+			putchar('.');
 		}
 	}
 }
\ No newline at end of file
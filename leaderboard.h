@@ -15,10 +15,6 @@
 // Maximum number of high scores
 #define MAX_NUM 5
 
-// Keyboard character ASCII constants
-#define ESCAPE_CHAR 27
-#define BACK_SPACE 127
-
 // Structure to store high scores
 typedef struct {
 	uint16_t signature;
@@ -2,78 +2,730 @@
  * ledmatrix.c
  *
  * Author: Peter Sutton
- * 
+ *
  * See the LED matrix Reference for details of the SPI commands used.
- */ 
+ * Commands are queued (see send_byte()) so these functions return
+ * before the command has reached the display.
+ *
+ * We keep a copy of what the display is showing (shown) as well as what
+ * it should show (frame). The update functions change frame, then the
+ * commit step works out the cheapest commands that make the display match
+ * it - single pixels, whole columns or rows, the whole display, a clear
+ * followed by whatever is not black, or a shift followed by whatever the
+ * shift didn't fix - and sends only those.
+ *
+ * Outside a frame, each update is committed straight away. Inside a frame
+ * (see ledmatrix_begin_frame()) frame is a back buffer - nothing is sent
+ * until the frame is committed, and then the differences go in one burst.
+ *
+ * Both buffers are packed (see PackedMatrix in ledmatrix.h) - they hold
+ * palette indexes, and colours are only looked up in the palette as the
+ * bytes are sent. The two of them take 2 x 64 = 128 bytes per panel, the
+ * same as one MatrixData, and the palette another 16 bytes (shared by all
+ * panels) - about half of what a shown and a frame MatrixData would take.
+ *
+ * After each command we leave whatever gap the timing in use (see
+ * ledmatrix_timing.h) asks for, so the board keeps up.
+ *
+ * With more than one panel, each has its own pair of buffers and its own
+ * dirty columns, and is committed on its own. Panels with nothing to send
+ * are skipped - and as a panel is only selected when the first byte for
+ * it is sent, they cost nothing. A shift of the display is a shift of
+ * every panel, with the column that crosses from one panel to the next
+ * patched afterwards.
+ */
 
+#define F_CPU 8000000L
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <string.h>
 #include "ledmatrix.h"
+#include "ledmatrix_timing.h"
 #include "spi.h"
+#include "timer0.h"
 
-#define CMD_UPDATE_ALL 0x00
-#define CMD_UPDATE_PIXEL 0x01
-#define CMD_UPDATE_ROW 0x02
-#define CMD_UPDATE_COL 0x03
-#define CMD_SHIFT_DISPLAY 0x04
-#define CMD_CLEAR_SCREEN 0x0F
+// Shift directions (the CMD_SHIFT_DISPLAY argument)
+#define SHIFT_NONE 0x00
+#define SHIFT_RIGHT 0x01
+#define SHIFT_LEFT 0x02
+#define SHIFT_DOWN 0x04
+#define SHIFT_UP 0x08
 
-void ledmatrix_setup(void) {
-	// Setup SPI - we divide the clock by 128.
-	// (This speed guarantees the SPI buffer will never overflow.)
-	spi_setup_master(128);
+// Safe timings, and the one in use
+static const LedTiming timings[LED_NUM_TIMINGS] PROGMEM = LED_TIMINGS;
+static uint8_t timing = 0;
+
+// Cost (SPI bytes) of each command
+#define PIXEL_COST 3
+#define COLUMN_COST (2 + MATRIX_NUM_ROWS)
+#define ROW_COST (2 + MATRIX_NUM_COLUMNS)
+#define ALL_COST (1 + MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS)
+#define SHIFT_COST 2
+#define CLEAR_COST 1
+
+// What each panel shows and what it should show
+static PackedMatrix panel_shown[LED_NUM_PANELS];
+static PackedMatrix panel_frame[LED_NUM_PANELS];
+
+// The panel being updated or committed (shown and frame point to its
+// buffers), and the panel the SPI select line is set to
+static uint8_t panel = 0;
+static PackedColumn* shown = panel_shown[0];
+static PackedColumn* frame = panel_frame[0];
+static uint8_t selected_panel = 0;
+
+// Colours of the palette indexes, and the number in use
+static PixelColour palette[PALETTE_SIZE] = { COLOUR_BLACK };
+static uint8_t palette_size = 1;
+
+// Columns of each panel's frame that may differ from shown, and a shift
+// (of every frame) not yet sent to the display
+static uint16_t dirty_columns[LED_NUM_PANELS];
+static uint8_t pending_shift = SHIFT_NONE;
+
+// Number of frames begun and not yet committed (they can be nested), when
+// the outermost began (microseconds), SPI bytes sent since it began (by
+// any commit - a second shift commits part way through a frame), and the
+// frame counters
+static uint8_t frame_depth = 0;
+static uint32_t frame_start;
+static uint16_t commit_bytes;
+static LedFrameStats frame_stats;
+
+/* Make p the current panel.
+ */
+static void set_panel(uint8_t p) {
+	panel = p;
+	shown = panel_shown[p];
+	frame = panel_frame[p];
 }
 
-void ledmatrix_update_all(MatrixData data) {
-	(void)spi_send_byte(CMD_UPDATE_ALL);
+/* Make the panel display column x is on the current one, and return the
+ * column on that panel.
+ */
+static uint8_t panel_column(uint8_t x) {
+	set_panel((x & (LED_DISPLAY_COLUMNS - 1)) / MATRIX_NUM_COLUMNS);
+	return x & 0x0F;
+}
+
+/* Queue a byte for the current panel, counting it.
+ */
+static void send_byte(uint8_t byte) {
+	if(panel != selected_panel) {
+		spi_queue_select(panel);
+		selected_panel = panel;
+	}
+	spi_queue_byte(byte);
+	commit_bytes++;
+}
+
+/* Leave the gap needed after a command, once its last byte is queued.
+ */
+static void end_command(uint8_t command) {
+	spi_queue_gap(pgm_read_word(&timings[timing].gap[LED_COMMAND_NUMBER(command)]));
+}
+
+/* Send the colour of palette index (the low nibble of) index.
+ */
+static void send_colour(uint8_t index) {
+	send_byte(palette[index & 0x0F]);
+}
+
+/* Return column x of shown as it would be after shifting the display in
+ * the given direction. Pixels shifted in from outside are black (index 0).
+ */
+static uint32_t shifted_column(uint8_t x, uint8_t shift) {
+	switch(shift) {
+		case SHIFT_RIGHT:
+			return x > 0 ? shown[x - 1].word : 0;
+		case SHIFT_LEFT:
+			return x < MATRIX_NUM_COLUMNS - 1 ? shown[x + 1].word : 0;
+		case SHIFT_UP:
+			return shown[x].word << 4;
+		case SHIFT_DOWN:
+			return shown[x].word >> 4;
+	}
+	return shown[x].word;
+}
+
+/* Work out which pixels would still need to be sent if the display first
+ * had the given shift applied (SHIFT_NONE for none) or, if cleared is set,
+ * was cleared. dirty[x] gets bit y set if pixel (x, y) must be sent.
+ * Only columns in columns are looked at. Returns the number of pixels.
+ */
+static uint8_t find_dirty(uint8_t* dirty, uint16_t columns, uint8_t shift, uint8_t cleared) {
+	uint8_t x, i;
+	uint8_t count = 0;
+	PackedColumn changed;
+
+	for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		dirty[x] = 0;
+		if(!(columns & ((uint16_t)1 << x))) {
+			continue;
+		}
+		// Non-zero nibbles are the pixels that differ
+		changed.word = frame[x].word ^ (cleared ? 0 : shifted_column(x, shift));
+		for(i = 0; i < MATRIX_NUM_ROWS / 2; i++) {
+			if(changed.bytes[i] & 0x0F) {
+				dirty[x] |= (1 << (2 * i));
+				count++;
+			}
+			if(changed.bytes[i] & 0xF0) {
+				dirty[x] |= (2 << (2 * i));
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+static uint8_t bits_set(uint8_t bits) {
+	uint8_t count = 0;
+	for(; bits; bits >>= 1) {
+		count += bits & 1;
+	}
+	return count;
+}
+
+/* Send (if send is set) one command of each kind, updating shown.
+ */
+static void send_pixel(uint8_t x, uint8_t y, uint8_t send) {
+	if(send) {
+		send_byte(CMD_UPDATE_PIXEL);
+		send_byte(((y & 0x07)<<4) | (x & 0x0F));
+		send_colour(packed_get(frame, x, y));
+		packed_set(shown, x, y, packed_get(frame, x, y));
+		end_command(CMD_UPDATE_PIXEL);
+	}
+}
+
+static void send_column(uint8_t x, uint8_t send) {
+	if(send) {
+		send_byte(CMD_UPDATE_COL);
+		send_byte(x & 0x0F); // column number
+		for(uint8_t i = 0; i<MATRIX_NUM_ROWS / 2; i++) {
+			send_colour(frame[x].bytes[i]);
+			send_colour(frame[x].bytes[i] >> 4);
+		}
+		shown[x] = frame[x];
+		end_command(CMD_UPDATE_COL);
+	}
+}
+
+static void send_row(uint8_t y, uint8_t send) {
+	if(send) {
+		send_byte(CMD_UPDATE_ROW);
+		send_byte(y & 0x07);	// row number
+		for(uint8_t x = 0; x<MATRIX_NUM_COLUMNS; x++) {
+			send_colour(packed_get(frame, x, y));
+			packed_set(shown, x, y, packed_get(frame, x, y));
+		}
+		end_command(CMD_UPDATE_ROW);
+	}
+}
+
+/* Return the cost of sending the pixels in dirty[] (see find_dirty()),
+ * and send them if send is set. First each row (if rows_first is set,
+ * otherwise each column) with enough dirty pixels is sent whole, then
+ * each column (or row) with enough of the remaining pixels, then single
+ * pixels. dirty[] is changed.
+ */
+static uint16_t patch(uint8_t* dirty, uint8_t rows_first, uint8_t send) {
+	uint16_t cost = 0;
+	uint8_t pass, x, y, count;
+
+	for(pass = 0; pass < 2; pass++) {
+		if(rows_first == (pass == 0)) {
+			for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+				count = 0;
+				for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+					count += (dirty[x] >> y) & 1;
+				}
+				if(count * PIXEL_COST > ROW_COST) {
+					cost += ROW_COST;
+					send_row(y, send);
+					for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+						dirty[x] &= ~(1 << y);
+					}
+				}
+			}
+		} else {
+			for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				if(bits_set(dirty[x]) * PIXEL_COST > COLUMN_COST) {
+					cost += COLUMN_COST;
+					send_column(x, send);
+					dirty[x] = 0;
+				}
+			}
+		}
+	}
+	for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+			if(dirty[x] & (1 << y)) {
+				cost += PIXEL_COST;
+				send_pixel(x, y, send);
+			}
+		}
+	}
+	return cost;
+}
+
+/* Return the cheapest cost of sending the pixels in dirty[] and whether
+ * that is with rows first (in *rows_first).
+ */
+static uint16_t patch_cost(const uint8_t* dirty, uint8_t* rows_first) {
+	uint8_t copy[MATRIX_NUM_COLUMNS];
+	uint16_t by_rows, by_columns;
+
+	memcpy(copy, dirty, sizeof(copy));
+	by_rows = patch(copy, 1, 0);
+	memcpy(copy, dirty, sizeof(copy));
+	by_columns = patch(copy, 0, 0);
+	*rows_first = by_rows < by_columns;
+	return *rows_first ? by_rows : by_columns;
+}
+
+/* Shift a packed buffer in the given direction, as the display does.
+ * Pixels shifted in are black.
+ */
+static void shift_packed(PackedMatrix m, uint8_t shift) {
+	uint8_t x;
+
+	switch(shift) {
+		case SHIFT_RIGHT:
+			packed_blit(m, 1, m, 0, MATRIX_NUM_COLUMNS - 1);
+			m[0].word = 0;
+			break;
+		case SHIFT_LEFT:
+			packed_blit(m, 0, m, 1, MATRIX_NUM_COLUMNS - 1);
+			m[MATRIX_NUM_COLUMNS - 1].word = 0;
+			break;
+		case SHIFT_UP:
+			for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				m[x].word <<= 4;
+			}
+			break;
+		case SHIFT_DOWN:
+			for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				m[x].word >>= 4;
+			}
+			break;
+	}
+}
+
+/* Send the other commands (updating shown).
+ */
+static void send_all(void) {
+	send_byte(CMD_UPDATE_ALL);
 	for(uint8_t y=0; y<MATRIX_NUM_ROWS; y++) {
 		for(uint8_t x=0; x<MATRIX_NUM_COLUMNS; x++) {
-			(void)spi_send_byte(data[x][y]);
+			send_colour(packed_get(frame, x, y));
+		}
+	}
+	end_command(CMD_UPDATE_ALL);
+	memcpy(shown, frame, sizeof(PackedMatrix));
+}
+
+static void send_shift(uint8_t shift) {
+	send_byte(CMD_SHIFT_DISPLAY);
+	send_byte(shift);
+	end_command(CMD_SHIFT_DISPLAY);
+	shift_packed(shown, shift);
+}
+
+static void send_clear(void) {
+	send_byte(CMD_CLEAR_SCREEN);
+	end_command(CMD_CLEAR_SCREEN);
+	packed_fill(shown, 0);
+}
+
+/* Make the current panel match its frame as cheaply as possible.
+ */
+static void commit_panel(void) {
+	uint8_t dirty[MATRIX_NUM_COLUMNS];
+	uint8_t rows_first, shift_rows_first = 0, clear_rows_first = 0;
+	uint16_t cost, shift_cost, clear_cost;
+	uint16_t columns = dirty_columns[panel];
+
+	if(pending_shift != SHIFT_NONE) {
+		// Every column may have changed
+		columns = 0xFFFF;
+	}
+	if(!columns) {
+		return;
+	}
+
+	// The options: patch what is there, shift first (if frame has been
+	// shifted), clear first, or send everything. (Clearing is only worth
+	// considering if the whole display may have changed.)
+	find_dirty(dirty, columns, SHIFT_NONE, 0);
+	cost = patch_cost(dirty, &rows_first);
+	shift_cost = 0xFFFF;
+	clear_cost = 0xFFFF;
+	if(pending_shift != SHIFT_NONE) {
+		find_dirty(dirty, columns, pending_shift, 0);
+		shift_cost = SHIFT_COST + patch_cost(dirty, &shift_rows_first);
+	}
+	if(columns == 0xFFFF && cost > CLEAR_COST) {
+		find_dirty(dirty, columns, SHIFT_NONE, 1);
+		clear_cost = CLEAR_COST + patch_cost(dirty, &clear_rows_first);
+	}
+
+	if(ALL_COST <= cost && ALL_COST <= shift_cost && ALL_COST <= clear_cost) {
+		send_all();
+	} else if(clear_cost < cost && clear_cost < shift_cost) {
+		send_clear();
+		find_dirty(dirty, 0xFFFF, SHIFT_NONE, 0);
+		patch(dirty, clear_rows_first, 1);
+	} else if(shift_cost < cost) {
+		send_shift(pending_shift);
+		find_dirty(dirty, columns, SHIFT_NONE, 0);
+		patch(dirty, shift_rows_first, 1);
+	} else {
+		find_dirty(dirty, columns, SHIFT_NONE, 0);
+		patch(dirty, rows_first, 1);
+	}
+	dirty_columns[panel] = 0;
+}
+
+/* Make every panel match its frame.
+ */
+static void commit(void) {
+	uint8_t p;
+
+	for(p = 0; p < LED_NUM_PANELS; p++) {
+		set_panel(p);
+		commit_panel();
+	}
+	pending_shift = SHIFT_NONE;
+}
+
+/* Commit, unless inside a frame (when the commit is left for
+ * ledmatrix_commit_frame()).
+ */
+static void commit_unless_in_frame(void) {
+	if(!frame_depth) {
+		commit();
+	}
+}
+
+/* Shift every panel's frame in the given direction and commit (unless
+ * inside a frame). Columns shifted off one panel go onto the next.
+ */
+static void shift_frame(uint8_t shift) {
+	uint8_t p;
+
+	if(pending_shift != SHIFT_NONE) {
+		// Only one shift can be considered at a time - send what there
+		// is so far
+		commit();
+	}
+	for(p = 0; p < LED_NUM_PANELS; p++) {
+		if(shift == SHIFT_RIGHT) {
+			// Right to left, so each panel's last column is taken
+			// before that panel is shifted
+			set_panel(LED_NUM_PANELS - 1 - p);
+			shift_packed(frame, shift);
+			if(panel > 0) {
+				frame[0] = panel_frame[panel - 1][MATRIX_NUM_COLUMNS - 1];
+			}
+		} else {
+			set_panel(p);
+			shift_packed(frame, shift);
+			if(shift == SHIFT_LEFT && panel + 1 < LED_NUM_PANELS) {
+				frame[MATRIX_NUM_COLUMNS - 1] = panel_frame[panel + 1][0];
+			}
 		}
 	}
+	pending_shift = shift;
+	commit_unless_in_frame();
+}
+
+void ledmatrix_setup(void) {
+	// Setup SPI with the first (slowest) timing - we divide the clock by
+	// 128. (This speed guarantees the board's buffer will never overflow,
+	// without any gaps. See ledmatrix_set_timing() for faster ones.)
+	timing = 0;
+	spi_setup_master(pgm_read_byte(&timings[0].divider));
+	selected_panel = 0;
+	if(LED_NUM_PANELS > 1) {
+		spi_setup_select_lines(LED_NUM_PANELS);
+	}
+
+	// Start from a known (blank) display
+	for(uint8_t p = 0; p < LED_NUM_PANELS; p++) {
+		set_panel(p);
+		send_clear();
+		packed_fill(frame, 0);
+	}
+}
+
+uint8_t ledmatrix_set_timing(uint8_t entry) {
+	if(entry >= LED_NUM_TIMINGS) {
+		return 0;
+	}
+	// Anything queued goes at the old timing
+	spi_flush();
+	timing = entry;
+	spi_setup_master(pgm_read_byte(&timings[entry].divider));
+	selected_panel = 0;
+	return 1;
+}
+
+uint8_t ledmatrix_get_timing(void) {
+	return timing;
+}
+
+/* Wait for the display to catch up, then leave a self-test stage up long
+ * enough to be seen.
+ */
+static void show_stage(void) {
+	spi_flush();
+	_delay_ms(500);
+}
+
+/* Run the self-test on the current panel.
+ */
+static void self_test_panel(void) {
+	uint8_t x, y, round;
+
+	// Clears, then whole display updates (red)
+	for(round = 0; round < 32; round++) {
+		send_clear();
+	}
+	packed_fill(frame, ledmatrix_palette_index(COLOUR_RED));
+	for(round = 0; round < 4; round++) {
+		send_all();
+	}
+	show_stage();
+
+	// Rows (green), columns (yellow) and pixels (orange)
+	packed_fill(frame, ledmatrix_palette_index(COLOUR_GREEN));
+	for(round = 0; round < 4; round++) {
+		for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+			send_row(y, 1);
+		}
+	}
+	show_stage();
+	packed_fill(frame, ledmatrix_palette_index(COLOUR_YELLOW));
+	for(round = 0; round < 4; round++) {
+		for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			send_column(x, 1);
+		}
+	}
+	show_stage();
+	packed_fill(frame, ledmatrix_palette_index(COLOUR_ORANGE));
+	for(round = 0; round < 2; round++) {
+		for(x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			for(y = 0; y < MATRIX_NUM_ROWS; y++) {
+				send_pixel(x, y, 1);
+			}
+		}
+	}
+	show_stage();
+
+	// Shifts - leaves the bottom left quarter orange
+	for(round = 0; round < 8; round++) {
+		send_shift(SHIFT_LEFT);
+		send_shift(round & 1 ? SHIFT_DOWN : SHIFT_RIGHT);
+		send_shift(round & 1 ? SHIFT_UP : SHIFT_LEFT);
+	}
+	for(round = 0; round < MATRIX_NUM_ROWS / 2; round++) {
+		send_shift(SHIFT_DOWN);
+	}
+	spi_flush();
+
+	// The panel now shows shown
+	memcpy(frame, shown, sizeof(PackedMatrix));
+	dirty_columns[panel] = 0;
+}
+
+void ledmatrix_self_test(void) {
+	// Anything not yet sent goes first
+	commit();
+	for(uint8_t p = 0; p < LED_NUM_PANELS; p++) {
+		set_panel(p);
+		self_test_panel();
+	}
+}
+
+void ledmatrix_flush(void) {
+	spi_flush();
+}
+
+void ledmatrix_begin_frame(void) {
+	if(frame_depth++ == 0) {
+		frame_start = get_timer0_microseconds();
+		commit_bytes = 0;
+	}
+}
+
+void ledmatrix_commit_frame(void) {
+	uint32_t time;
+
+	if(frame_depth == 0 || --frame_depth > 0) {
+		return;	// Not in a frame, or the outer frame will commit
+	}
+	commit();
+	time = get_timer0_microseconds() - frame_start;
+
+	frame_stats.frames++;
+	frame_stats.last_bytes = commit_bytes;
+	frame_stats.last_time = time;
+	if(commit_bytes > frame_stats.max_bytes) {
+		frame_stats.max_bytes = commit_bytes;
+	}
+	if(time > frame_stats.max_time) {
+		frame_stats.max_time = time;
+	}
+}
+
+void ledmatrix_get_frame_stats(LedFrameStats* snapshot) {
+	*snapshot = frame_stats;
+}
+
+void ledmatrix_reset_frame_stats(void) {
+	memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+PaletteIndex ledmatrix_palette_index(PixelColour colour) {
+	uint8_t i, best = 0;
+	uint8_t distance, best_distance = 0xFF;
+	int8_t red, green;
+
+	for(i = 0; i < palette_size; i++) {
+		if(palette[i] == colour) {
+			return i;
+		}
+	}
+	if(palette_size < PALETTE_SIZE) {
+		palette[palette_size] = colour;
+		return palette_size++;
+	}
+	// Full - use the closest colour (red and green are each 4 bits)
+	for(i = 0; i < PALETTE_SIZE; i++) {
+		red = (int8_t)(palette[i] & 0x0F) - (int8_t)(colour & 0x0F);
+		green = (int8_t)(palette[i] >> 4) - (int8_t)(colour >> 4);
+		distance = (red < 0 ? -red : red) + (green < 0 ? -green : green);
+		if(distance < best_distance) {
+			best_distance = distance;
+			best = i;
+		}
+	}
+	return best;
+}
+
+PixelColour ledmatrix_palette_colour(PaletteIndex index) {
+	return palette[index & 0x0F];
+}
+
+PaletteIndex packed_get(const PackedMatrix m, uint8_t x, uint8_t y) {
+	uint8_t byte = m[x & 0x0F].bytes[(y & 0x07) >> 1];
+	return (y & 1) ? (byte >> 4) : (byte & 0x0F);
+}
+
+void packed_set(PackedMatrix m, uint8_t x, uint8_t y, PaletteIndex index) {
+	uint8_t* byte = &m[x & 0x0F].bytes[(y & 0x07) >> 1];
+	if(y & 1) {
+		*byte = (*byte & 0x0F) | (index << 4);
+	} else {
+		*byte = (*byte & 0xF0) | (index & 0x0F);
+	}
+}
+
+void packed_fill(PackedMatrix m, PaletteIndex index) {
+	memset(m, (index & 0x0F) * 0x11, sizeof(PackedMatrix));
+}
+
+void packed_blit(PackedMatrix dst, uint8_t dst_x, const PackedMatrix src, uint8_t src_x,
+		uint8_t width) {
+	if(dst_x >= MATRIX_NUM_COLUMNS || src_x >= MATRIX_NUM_COLUMNS) {
+		return;
+	}
+	if(width > MATRIX_NUM_COLUMNS - dst_x) {
+		width = MATRIX_NUM_COLUMNS - dst_x;
+	}
+	if(width > MATRIX_NUM_COLUMNS - src_x) {
+		width = MATRIX_NUM_COLUMNS - src_x;
+	}
+	memmove(&dst[dst_x], &src[src_x], width * sizeof(PackedColumn));
+}
+
+void ledmatrix_update_all(uint8_t panel_number, MatrixData data) {
+	set_panel(panel_number & (LED_NUM_PANELS - 1));
+	for(uint8_t x = 0; x<MATRIX_NUM_COLUMNS; x++) {
+		for(uint8_t y = 0; y<MATRIX_NUM_ROWS; y++) {
+			packed_set(frame, x, y, ledmatrix_palette_index(data[x][y]));
+		}
+	}
+	dirty_columns[panel] = 0xFFFF;
+	commit_unless_in_frame();
+}
+
+void ledmatrix_update_packed(uint8_t panel_number, const PackedMatrix data) {
+	set_panel(panel_number & (LED_NUM_PANELS - 1));
+	memcpy(frame, data, sizeof(PackedMatrix));
+	dirty_columns[panel] = 0xFFFF;
+	commit_unless_in_frame();
 }
 
 void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
-	(void)spi_send_byte(CMD_UPDATE_PIXEL);
-	(void)spi_send_byte( ((y & 0x07)<<4) | (x & 0x0F));
-	(void)spi_send_byte(pixel);
+	x = panel_column(x);
+	y &= 0x07;
+	packed_set(frame, x, y, ledmatrix_palette_index(pixel));
+	dirty_columns[panel] |= ((uint16_t)1 << x);
+	commit_unless_in_frame();
 }
 
 void ledmatrix_update_row(uint8_t y, MatrixRow row) {
-	(void)spi_send_byte(CMD_UPDATE_ROW);
-	(void)spi_send_byte(y & 0x07);	// row number
-	for(uint8_t x = 0; x<MATRIX_NUM_COLUMNS; x++) {
-		(void)spi_send_byte(row[x]);
+	uint8_t column;
+
+	y &= 0x07;
+	for(uint8_t x = 0; x<LED_DISPLAY_COLUMNS; x++) {
+		column = panel_column(x);
+		packed_set(frame, column, y, ledmatrix_palette_index(row[x]));
+		dirty_columns[panel] |= ((uint16_t)1 << column);
 	}
+	commit_unless_in_frame();
 }
 
 void ledmatrix_update_column(uint8_t x, MatrixColumn col) {
-	(void)spi_send_byte(CMD_UPDATE_COL);
-	(void)spi_send_byte(x & 0x0F); // column number
+	x = panel_column(x);
 	for(uint8_t y = 0; y<MATRIX_NUM_ROWS; y++) {
-		(void)spi_send_byte(col[y]);
+		packed_set(frame, x, y, ledmatrix_palette_index(col[y]));
 	}
+	dirty_columns[panel] |= ((uint16_t)1 << x);
+	commit_unless_in_frame();
+}
+
+void ledmatrix_update_column_masked(uint8_t x, uint32_t column, uint32_t mask) {
+	x = panel_column(x);
+	frame[x].word = (frame[x].word & ~mask) | (column & mask);
+	dirty_columns[panel] |= ((uint16_t)1 << x);
+	commit_unless_in_frame();
 }
 
 void ledmatrix_shift_display_left(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x02);
+	shift_frame(SHIFT_LEFT);
 }
 
 void ledmatrix_shift_display_right(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x01);
+	shift_frame(SHIFT_RIGHT);
 }
 
 void ledmatrix_shift_display_up(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x08);
+	shift_frame(SHIFT_UP);
 }
 
 void ledmatrix_shift_display_down(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x04);
+	shift_frame(SHIFT_DOWN);
 }
 
 void ledmatrix_clear(void) {
-	(void)spi_send_byte(CMD_CLEAR_SCREEN);
-}
\ No newline at end of file
+	for(uint8_t p = 0; p < LED_NUM_PANELS; p++) {
+		packed_fill(panel_frame[p], 0);
+		dirty_columns[p] = 0xFFFF;
+	}
+	commit_unless_in_frame();
+}
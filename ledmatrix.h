@@ -16,23 +16,123 @@
 #define MATRIX_NUM_COLUMNS 16
 #define MATRIX_NUM_ROWS 8
 
-// Data types which can be used to store display information
+// The display can be made up of LED_NUM_PANELS matrices (1, 2 or 4 -
+// e.g. build with -DLED_NUM_PANELS=2) side by side, each with its own
+// slave select line (see spi.h). Panel 0 is on the left. Display columns
+// (x) then range from 0 to LED_DISPLAY_COLUMNS - 1 across all of them.
+#ifndef LED_NUM_PANELS
+#define LED_NUM_PANELS 1
+#endif
+#if LED_NUM_PANELS != 1 && LED_NUM_PANELS != 2 && LED_NUM_PANELS != 4
+#error "LED_NUM_PANELS must be 1, 2 or 4"
+#endif
+#define LED_DISPLAY_COLUMNS (LED_NUM_PANELS * MATRIX_NUM_COLUMNS)
+
+// Data types which can be used to store display information. (MatrixData
+// is one panel, a MatrixRow goes across every panel.)
 typedef PixelColour MatrixData[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
-typedef PixelColour MatrixRow[MATRIX_NUM_COLUMNS];
+typedef PixelColour MatrixRow[LED_DISPLAY_COLUMNS];
 typedef PixelColour MatrixColumn[MATRIX_NUM_ROWS];
 
+// Packed frame buffers hold a 4 bit palette index for each pixel rather
+// than its colour - two pixels per byte, so half the size of MatrixData.
+// Each column is one 32 bit word with pixel y in bits 4y to 4y+3 (the low
+// nibble of byte y/2 for even y, the high nibble for odd y), so whole
+// columns can be copied, compared and shifted at once.
+#define PALETTE_SIZE 16
+typedef uint8_t PaletteIndex;
+typedef union {
+	uint32_t word;
+	uint8_t bytes[MATRIX_NUM_ROWS / 2];
+} PackedColumn;
+typedef PackedColumn PackedMatrix[MATRIX_NUM_COLUMNS];
+
+// The palette. Index 0 is always black. ledmatrix_palette_index() returns
+// the index for a colour, adding the colour to the palette if it isn't
+// there yet. Once the palette is full, the closest colour is used.
+// Entries never change once added.
+PaletteIndex ledmatrix_palette_index(PixelColour colour);
+PixelColour ledmatrix_palette_colour(PaletteIndex index);
+
+// Get or set one pixel of a packed buffer, fill a packed buffer with one
+// palette index, or copy width columns starting at column src_x of src to
+// dst starting at column dst_x (columns beyond the edge are left out;
+// src and dst may be the same buffer).
+PaletteIndex packed_get(const PackedMatrix m, uint8_t x, uint8_t y);
+void packed_set(PackedMatrix m, uint8_t x, uint8_t y, PaletteIndex index);
+void packed_fill(PackedMatrix m, PaletteIndex index);
+void packed_blit(PackedMatrix dst, uint8_t dst_x, const PackedMatrix src, uint8_t src_x,
+		uint8_t width);
+
 // Setup SPI communication with the LED matrix
 void ledmatrix_setup(void);
 
-// Functions to update the display
-void ledmatrix_update_all(MatrixData data);
+// SPI timing. entry is a position in the table of safe timings in
+// ledmatrix_timing.h - 0 (the slowest) is used after ledmatrix_setup().
+// Returns 0 if there is no such entry. Entries other than 0 need timer 0
+// to be running (see init_timer0()).
+uint8_t ledmatrix_set_timing(uint8_t entry);
+uint8_t ledmatrix_get_timing(void);
+
+// Stress each command at the current timing, for checking that the board
+// keeps up. Sends bursts of clears then whole display updates (leaving
+// it red), rows (green), columns (yellow) and pixels (orange), pausing
+// after each, then shifts which leave the bottom left quarter orange and
+// the rest black. If the board dropped a byte, one of these won't look
+// right. Each panel is tested in turn, taking about 2 seconds each; the
+// display is left as described. The
+// host can choose a timing and run the self-test with
+// HOST_COMMAND_LED_TIMING (see serialio.h) followed by the entry as a
+// digit.
+void ledmatrix_self_test(void);
+
+// Functions to update the display. These queue the command and return
+// without waiting for it to be sent. Only panels that have changed are
+// sent anything. (ledmatrix_update_all() and ledmatrix_update_packed()
+// update one panel.)
+void ledmatrix_update_all(uint8_t panel, MatrixData data);
+void ledmatrix_update_packed(uint8_t panel, const PackedMatrix data);
 void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel);
 void ledmatrix_update_row(uint8_t y, MatrixRow row);
 void ledmatrix_update_column(uint8_t x, MatrixColumn col);
+// Change the pixels of column x picked out by mask to those of column.
+// Both are packed like a PackedColumn word - column holds palette
+// indexes, and mask has all 4 bits of each pixel to change set. This
+// changes several pixels at once (see gfx.h).
+void ledmatrix_update_column_masked(uint8_t x, uint32_t column, uint32_t mask);
 void ledmatrix_shift_display_left(void);
 void ledmatrix_shift_display_right(void);
 void ledmatrix_shift_display_up(void);
 void ledmatrix_shift_display_down(void);
 void ledmatrix_clear(void);
 
+// Wait until every queued command has been sent to the display (e.g. so
+// that something else happens after the display has changed)
+void ledmatrix_flush(void);
+
+// Frames. Between ledmatrix_begin_frame() and ledmatrix_commit_frame() the
+// update functions above only draw into a back buffer. The commit then
+// sends the differences from what the display shows in one burst, so the
+// display never shows a partly drawn frame. Frames can be nested - only
+// the outermost commit sends anything. Outside a frame each update is sent
+// straight away. (Only one shift is combined with the rest of a frame - a
+// second shift sends what has been drawn so far.)
+void ledmatrix_begin_frame(void);
+void ledmatrix_commit_frame(void);
+
+// Frame counters. The time is from the start of the (outermost) frame
+// until its commands have all been queued, so includes drawing it. The
+// bytes include any sent part way through the frame (by a second shift).
+typedef struct {
+	uint16_t frames;		// Frames committed
+	uint16_t last_bytes;	// SPI bytes sent for the last frame
+	uint16_t max_bytes;		// Most SPI bytes sent for one frame
+	uint32_t last_time;		// Time taken by the last frame (microseconds)
+	uint32_t max_time;		// Longest time taken by a frame (microseconds)
+} LedFrameStats;
+
+// Copy the frame counters into *snapshot, or zero them
+void ledmatrix_get_frame_stats(LedFrameStats* snapshot);
+void ledmatrix_reset_frame_stats(void);
+
 #endif /* LEDMATRIX_H_ */
\ No newline at end of file
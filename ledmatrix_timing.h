@@ -0,0 +1,60 @@
+/*
+ * ledmatrix_timing.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * The LED matrix board's SPI commands, and the table of timings that are
+ * safe to send them with. Shared by ledmatrix.c and the host model of the
+ * board (host/ledboard_model.c), which checks the table.
+ *
+ * The board takes each byte into a small receive buffer, and acts on a
+ * command once all of its bytes have arrived. While it is doing that (e.g.
+ * redrawing the whole display after CMD_UPDATE_ALL) it doesn't empty the
+ * buffer, so bytes arriving too quickly would be lost. The slowest SPI
+ * clock is slow enough that this never happens. With a faster clock we
+ * instead leave a gap after each command that takes the board a while.
+ */
+
+#ifndef LEDMATRIX_TIMING_H_
+#define LEDMATRIX_TIMING_H_
+
+#include <stdint.h>
+
+#define CMD_UPDATE_ALL 0x00
+#define CMD_UPDATE_PIXEL 0x01
+#define CMD_UPDATE_ROW 0x02
+#define CMD_UPDATE_COL 0x03
+#define CMD_SHIFT_DISPLAY 0x04
+#define CMD_CLEAR_SCREEN 0x0F
+
+// Commands are numbered 0 to LED_NUM_COMMANDS - 1 in the gap tables
+// (CMD_CLEAR_SCREEN is the last)
+#define LED_NUM_COMMANDS 6
+#define LED_COMMAND_NUMBER(command) \
+		((command) == CMD_CLEAR_SCREEN ? LED_NUM_COMMANDS - 1 : (command))
+
+/* One timing - the SPI clock divider, and the gap (microseconds) to leave
+ * after each command, indexed by LED_COMMAND_NUMBER(). (Gaps are timed to
+ * the next 8 microseconds, and can't be longer than about 990.)
+ */
+typedef struct {
+	uint8_t divider;
+	uint16_t gap[LED_NUM_COMMANDS];
+} LedTiming;
+
+/* The safe timings, from the slowest to the fastest. Entry 0 is always
+ * used to begin with. Use as
+ *		static const LedTiming timings[LED_NUM_TIMINGS] = LED_TIMINGS;
+ * Gaps are in the order all, pixel, row, column, shift, clear. They were
+ * chosen with host/ledboard_model so that the model's buffer never has
+ * more than 24 bytes waiting.
+ */
+#define LED_NUM_TIMINGS 4
+#define LED_TIMINGS { \
+	{ 128, { 0, 0, 0, 0, 0, 0 } }, \
+	{ 32, { 280, 0, 0, 0, 280, 160 } }, \
+	{ 16, { 720, 0, 0, 0, 320, 200 } }, \
+	{ 8, { 960, 0, 0, 0, 360, 240 } } \
+}
+
+#endif /* LEDMATRIX_TIMING_H_ */
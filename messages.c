@@ -0,0 +1,68 @@
+/*
+ * messages.c
+ *
+ * Author: Thuan Song Teoh
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "messages.h"
+#include "serialio.h"
+
+static const char msg_title[] PROGMEM = "RallyRacer";
+static const char msg_credits[] PROGMEM = "CSSE2010/7201 project by Thuan Song Teoh";
+static const char msg_press_to_start[] PROGMEM = "Press a button/key to start";
+static const char msg_press_to_restart[] PROGMEM = "Press a button/key to start again";
+static const char msg_loading[] PROGMEM = "Loading...";
+static const char msg_level[] PROGMEM = "Level ";
+static const char msg_lives[] PROGMEM = "Lives: ";
+static const char msg_score[] PROGMEM = "Score: ";
+static const char msg_lap_time[] PROGMEM = "Lap Time: ";
+static const char msg_seconds[] PROGMEM = " second(s)";
+static const char msg_paused[] PROGMEM = "Paused...";
+static const char msg_lap_complete[] PROGMEM = "LAP COMPLETE";
+static const char msg_game_over[] PROGMEM = "GAME OVER";
+static const char msg_congratulations[] PROGMEM = "CONGRATULATIONS!";
+static const char msg_new_high_score[] PROGMEM = "You got a new high score!";
+static const char msg_enter_initials[] PROGMEM = "Please enter your initials (max 5)";
+static const char msg_press_enter[] PROGMEM = "Press enter to save:";
+static const char msg_leader_board[] PROGMEM = "LEADER BOARD";
+static const char msg_leader_board_heading[] PROGMEM = "Name      ->     Score";
+static const char msg_arrow[] PROGMEM = "->";
+
+// In MessageId order
+static const char* const messages[NUM_MESSAGES] PROGMEM = {
+	msg_title,
+	msg_credits,
+	msg_press_to_start,
+	msg_press_to_restart,
+	msg_loading,
+	msg_level,
+	msg_lives,
+	msg_score,
+	msg_lap_time,
+	msg_seconds,
+	msg_paused,
+	msg_lap_complete,
+	msg_game_over,
+	msg_congratulations,
+	msg_new_high_score,
+	msg_enter_initials,
+	msg_press_enter,
+	msg_leader_board,
+	msg_leader_board_heading,
+	msg_arrow
+};
+
+void put_message(MessageId id) {
+	serial_put_P((const char*)pgm_read_word(&messages[id]));
+}
+
+uint8_t message_copy(char* text, MessageId id) {
+	const char* message = (const char*)pgm_read_word(&messages[id]);
+	uint8_t length = strlen_P(message);
+	memcpy_P(text, message, length);
+	return length;
+}
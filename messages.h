@@ -0,0 +1,47 @@
+/*
+ * messages.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * The text shown on the terminal, kept in one table in program memory so
+ * that each string is stored once however many places use it.
+ */
+
+#ifndef MESSAGES_H_
+#define MESSAGES_H_
+
+#include <stdint.h>
+
+typedef enum {
+	MSG_TITLE,				// "RallyRacer"
+	MSG_CREDITS,
+	MSG_PRESS_TO_START,
+	MSG_PRESS_TO_RESTART,
+	MSG_LOADING,			// "Loading..."
+	MSG_LEVEL,				// "Level "
+	MSG_LIVES,				// "Lives: "
+	MSG_SCORE,				// "Score: "
+	MSG_LAP_TIME,			// "Lap Time: "
+	MSG_SECONDS,			// " second(s)"
+	MSG_PAUSED,				// "Paused..."
+	MSG_LAP_COMPLETE,
+	MSG_GAME_OVER,
+	MSG_CONGRATULATIONS,
+	MSG_NEW_HIGH_SCORE,
+	MSG_ENTER_INITIALS,
+	MSG_PRESS_ENTER,
+	MSG_LEADER_BOARD,
+	MSG_LEADER_BOARD_HEADING,
+	MSG_ARROW,				// "->"
+	NUM_MESSAGES
+} MessageId;
+
+/* Send a message (straight from program memory - see serial_put_P()).
+ */
+void put_message(MessageId id);
+
+/* Copy a message into text (no terminating null). Returns its length.
+ */
+uint8_t message_copy(char* text, MessageId id);
+
+#endif /* MESSAGES_H_ */
@@ -15,6 +15,7 @@
 
 #include "ledmatrix.h"
 #include "scrolling_char_display.h"
+#include "animation.h"
 #include "buttons.h"
 #include "serialio.h"
 #include "terminalio.h"
@@ -26,6 +27,12 @@
 #include "joystick.h"
 #include "project.h"
 #include "leaderboard.h"
+#include "telemetry.h"
+#include "keyboard.h"
+#include "term.h"
+#include "hud.h"
+#include "textout.h"
+#include "messages.h"
 
 #define F_CPU 8000000L
 #include <util/delay.h>
@@ -42,6 +49,13 @@ void handle_new_lap(void);
 void display_lives(void);
 void set_disp_lives(uint8_t num);
 void reset_speed(void);
+void display_score(void);
+void display_lap_time(void);
+void update_hud(void);
+void draw_hud(void);
+void handle_host_commands(void);
+void debug_number(const char* label, uint32_t value);
+void write_lap_log(void);
 
 // Speed of car
 uint16_t speed;
@@ -54,8 +68,27 @@ uint8_t paused = 0;
 // Game level
 uint8_t level;
 
-// ASCII code for Escape character
-#define ESCAPE_CHAR 27
+// HUD values waiting to be redrawn (1 if the value shown is out of date)
+uint8_t score_dirty, lap_time_dirty;
+
+// The HUD is lower priority than the playfield. It is only redrawn while
+// fewer than this many bytes are waiting to go out over the serial link
+// (about 30ms at 19200 baud), so the car and new rows are never queued
+// behind it. A HUD value that can't be sent yet stays dirty and the latest
+// value is sent once the link catches up.
+#define HUD_BACKLOG_LIMIT 64
+
+// The lap log is too long for the debug channel's buffer, so it is kept
+// here and written a line at a time, one line per pass of the game loop
+// (see write_lap_log()). lap_log_line is the next line to write, 0 if
+// there is nothing to write.
+#define LAP_LOG_LINES 6
+uint8_t lap_log_line;
+uint8_t lap_log_level;
+uint16_t lap_log_time, lap_log_blocked, lap_log_dropped;
+uint32_t lap_log_sent, lap_log_wait;
+TermStats lap_log_playfield;
+LedFrameStats lap_log_frames;
 
 /////////////////////////////// main //////////////////////////////////
 int main(void) {
@@ -96,6 +129,10 @@ void initialise_hardware(void) {
 	
 	// Turn on global interrupts
 	sei();
+
+	// Find out whether the terminal can erase characters (the reply
+	// arrives while the splash screen is up)
+	request_terminal_attributes();
 }
 
 void splash_screen(void) {
@@ -105,65 +142,72 @@ void splash_screen(void) {
 	
 	hide_cursor();	// We don't need to see the cursor when we're just doing output
 	move_cursor(35,5);
-	printf_P(PSTR("RallyRacer"));
+	put_message(MSG_TITLE);
 	
 	move_cursor(20,7);
 	set_display_attribute(FG_GREEN);	// Make the text green
-	printf_P(PSTR("CSSE2010/7201 project by Thuan Song Teoh"));
+	put_message(MSG_CREDITS);
 	normal_display_mode();	// Return to default colour (White)
 
 	move_cursor(10,10);
-	printf_P(PSTR("Press a button/key to start"));
+	put_message(MSG_PRESS_TO_START);
 
 	leaderboard_terminal_output(); // Display leader board
 	
 	// Output the scrolling message to the LED matrix
 	// and wait for a push button to be pushed.
-	ledmatrix_clear();
-	
-	// Orange message the first time through
-	set_text_colour(COLOUR_ORANGE);
+	// Orange message the first time through. It moves every 130ms.
+	PixelColour colour = COLOUR_ORANGE;
 	while(1) {
-		set_scrolling_display_text("RALLYRACER 43068052");
+		ledmatrix_clear();
+		text_start(0, "RALLYRACER 43068052", colour, 130, 0, LED_DISPLAY_COLUMNS);
 		// Scroll the message until it has scrolled off the 
-		// display or a button/key is pushed. We pause for 130ms between each scroll.
-		while(scroll_display()) {
-			_delay_ms(130);
+		// display or a button/key is pushed
+		while(text_update()) {
+			if(button_pushed() != -1 || serial_input_available()) {
+				text_stop(0);
+				clear_serial_input_buffer();
+				return;
+			}
+		}
+		// Message has scrolled off the display. Drive the car along
+		// the road for a while
+		animation_start(ANIMATION_SPLASH);
+		while(animation_update()) {
 			if(button_pushed() != -1 || serial_input_available()) {
+				animation_stop();
 				clear_serial_input_buffer();
 				return;
 			}
 		}
-		// Message has scrolled off the display. Change colour
-		// to a random colour and scroll again.
+		// Change colour to a random colour and scroll again.
 		switch(random()%4) {
-			case 0: set_text_colour(COLOUR_LIGHT_ORANGE); break;
-			case 1: set_text_colour(COLOUR_RED); break;
-			case 2: set_text_colour(COLOUR_YELLOW); break;
-			case 3: set_text_colour(COLOUR_GREEN); break;
+			case 0: colour = COLOUR_LIGHT_ORANGE; break;
+			case 1: colour = COLOUR_RED; break;
+			case 2: colour = COLOUR_YELLOW; break;
+			case 3: colour = COLOUR_GREEN; break;
 		}
 	}
 }
 
 void level_splash_screen(void) {
 	// Build text
-	char txt[8] = "Level ";
-	char lvl[2];
-	sprintf(lvl, "%d", level+1);
-	strcat(txt, lvl);
+	char txt[8];
+	uint8_t length = message_copy(txt, MSG_LEVEL);
+	length += format_unsigned(&txt[length], level+1);
+	txt[length] = '\0';
 
-	// Output the scrolling message to the LED matrix
+	// Output the scrolling message to the LED matrix. (The message is
+	// rendered straight away, so txt needn't last.)
 	ledmatrix_clear();
-	clear_prev_msg();
 
-	// Orange message
-	set_text_colour(COLOUR_ORANGE);
-	set_scrolling_display_text(txt);
+	// Orange message, moving every 80ms
+	text_start(0, txt, COLOUR_ORANGE, 80, 0, LED_DISPLAY_COLUMNS);
 	// Scroll the message until it has scrolled off the
-	// display or a button/key is pushed. We pause for 80ms between each scroll.
-	while(scroll_display()) {
-		_delay_ms(80);
+	// display or a button/key is pushed
+	while(text_update()) {
 		if(button_pushed() != -1 || serial_input_available()) {
+			text_stop(0);
 			clear_serial_input_buffer();
 			return;
 		}
@@ -176,10 +220,10 @@ void new_game(void) {
 	level = 0;
 
 	// Inform that game is starting
-	set_display_attribute(FG_MAGENTA);
-	set_display_attribute(TERM_BRIGHT);
+	set_text_style(FG_MAGENTA, BG_DEFAULT, STYLE(TERM_BRIGHT));
 	move_cursor(10,10);
-	printf_P(PSTR("%-33s"),"Loading...");
+	put_message(MSG_LOADING);
+	put_spaces(23);	// Cover the rest of the splash screen prompt
 	normal_display_mode();
 
 	// Show level
@@ -208,125 +252,90 @@ void new_game(void) {
 	// Start lap timer
 	start_lap_timer();
 
-	// Display level
-	set_display_attribute(FG_YELLOW);
-	move_cursor(30,2);
-	printf_P(PSTR("Level %d"), level+1);
-	normal_display_mode();
-
-	// Display score
-	move_cursor(30,4);
-	printf_P(PSTR("Score: %ld"), get_score());
-	move_cursor(37, 8);
+	// Display level and score
+	draw_hud();
 }
 
 void play_game(void) {
 	uint32_t current_time, last_move_time, last_lap_timer_update, last_car_flash;
 	uint32_t crashed_time = 0L, powerup_time = 0L, last_powerup_flash = 0L;
 	int8_t button, joystick;
-	char serial_input, escape_sequence_char;
-	uint8_t characters_into_escape_sequence = 0;
+	uint8_t key;
 	uint8_t moves = 0;
 	
 	// Get the current time and remember this as the last time the background scrolled.
 	current_time = get_timer0_clock_ticks();
 	last_move_time = current_time;
 	last_lap_timer_update = current_time;
+
+	// The game never waits for the serial link. The playfield and HUD
+	// check for room and send what doesn't fit later (see term.c and
+	// update_hud()). Only things that are rare and must all be sent -
+	// e.g. redrawing the whole terminal - wait, and they turn blocking
+	// back on while they do.
+	set_serial_output_blocking(0);
 	
 	// We play the game while the player still has lives
 	while(get_lives() > 0) {
 		
 		// Check for input - which could be a button push or serial input.
-		// Serial input may be part of an escape sequence, e.g. ESC [ D
-		// is a left cursor key press. We will be processing each character
-		// independently and can't do anything until we get the third character.
-		// At most one of the following three variables will be set to a value 
-		// other than -1 if input is available.
-		// (We don't initalise button to -1 since button_pushed() will return -1
-		// if no button pushes are waiting to be returned.)
+		// Serial input has already been decoded into key codes (so the
+		// cursor keys arrive as single KEY_ codes - see keyboard.h).
+		// At most one of button and key will be set if input is available.
+		// (button_pushed() will return -1 if no button pushes are waiting
+		// to be returned.)
 		// Button pushes take priority over serial input. If there are both then
 		// we'll retrieve the serial input the next time through this loop
-		serial_input = -1;
-		escape_sequence_char = -1;
+		key = KEY_NONE;
 		button = button_pushed();
 		
 		if(button == -1) {
 			// No push button was pushed, see if there is any serial input
-			if(serial_input_available()) {
-				// Serial data was available - read the data from standard input
-				serial_input = fgetc(stdin);
-				// Check if the character is part of an escape sequence
-				if(characters_into_escape_sequence == 0 && serial_input == ESCAPE_CHAR) {
-					// We've hit the first character in an escape sequence (escape)
-					characters_into_escape_sequence++;
-					serial_input = -1; // Don't further process this character
-				} else if(characters_into_escape_sequence == 1 && serial_input == '[') {
-					// We've hit the second character in an escape sequence
-					characters_into_escape_sequence++;
-					serial_input = -1; // Don't further process this character
-				} else if(characters_into_escape_sequence == 2) {
-					// Third (and last) character in the escape sequence
-					escape_sequence_char = serial_input;
-					serial_input = -1;  // Don't further process this character - we
-										// deal with it as part of the escape sequence
-					characters_into_escape_sequence = 0;
-				} else {
-					// Character was not part of an escape sequence (or we received
-					// an invalid second character in the sequence). We'll process 
-					// the data in the serial_input variable.
-					characters_into_escape_sequence = 0;
-				}
-			}
+			key = serial_get_key();
 		}
 
-		if(serial_input == 'p' || serial_input == 'P') {
+		// Act on any command from a connected host (e.g. switching to
+		// telemetry output)
+		handle_host_commands();
+
+		if(key == 'p' || key == 'P') {
 			// Pause game (display, controls and timers)
 			if(!paused) {
 				// Clear buzzer bit to mute
 				PORTD &= ~(1<<3);
 			}
 			paused = !paused;
-			if(paused) {
-				set_display_attribute(FG_MAGENTA);
-				set_display_attribute(TERM_BRIGHT);
-				move_cursor(36,6);
-				printf_P(PSTR("Paused..."));
-				normal_display_mode();
-				move_cursor(37, 8);
-			} else {
-				move_cursor(36,6);
-				printf_P(PSTR("         "));
-				move_cursor(37, 8);
-			}
+			set_serial_output_blocking(1);
+			hud_set_paused(paused);
+			set_serial_output_blocking(0);
 		}
 
 		if(!paused) {
 			joystick = joystick_direction(); // Update joystick direction
 
 			// Process the input.
-			if(button==3 || escape_sequence_char=='D' || serial_input=='A' || serial_input=='a' || joystick==3) {
+			if(button==3 || key==KEY_LEFT || key=='A' || key=='a' || joystick==3) {
 				// Attempt to move left
 				if (!has_car_crashed()) {
 					move_car_left();
 					moves++;
 				}
-			} else if(button==0 || escape_sequence_char=='C' || serial_input=='D' || serial_input=='d' || joystick==4) {
+			} else if(button==0 || key==KEY_RIGHT || key=='D' || key=='d' || joystick==4) {
 				// Attempt to move right
 				if (!has_car_crashed()) {
 					move_car_right();
 					moves++;
 				}
-			} else if(button==2 || escape_sequence_char=='A' || serial_input=='W' || serial_input=='w' || joystick==1) {
+			} else if(button==2 || key==KEY_UP || key=='W' || key=='w' || joystick==1) {
 				if(speed > 100) {
 					speed -= 100;
 				}
-			} else if(button==1 || escape_sequence_char=='B' || serial_input=='S' || serial_input=='s' || joystick==2) {
+			} else if(button==1 || key==KEY_DOWN || key=='S' || key=='s' || joystick==2) {
 				if(speed < level_speed[level]) {
 					speed += 100;
 				}
 			}
-			// else - invalid input or we're part way through an escape sequence -
-			// do nothing
+			// else - no input or invalid input - do nothing
 
 			current_time = get_timer0_clock_ticks();
 			if(powerup_time && current_time >= powerup_time + 5000) {
@@ -347,9 +356,7 @@ void play_game(void) {
 
 			// Only update lap timer every 0.1s
 			if(current_time >= last_lap_timer_update + 100) {
-				move_cursor(30,5);
-				printf_P(PSTR("Lap Time: %d.%d second(s)"), get_lap_timer()/10, get_lap_timer()%10);
-				move_cursor(37, 8);
+				lap_time_dirty = 1;
 				last_lap_timer_update = current_time;
 			}
 
@@ -362,20 +369,18 @@ void play_game(void) {
 				scroll_background();
 				if(moves < 5) {
 					add_to_score(5 - moves);
-					move_cursor(30,4);
-					printf_P(PSTR("Score: %ld"), get_score());
-					move_cursor(37, 8);
+					score_dirty = 1;
 				}
 				moves = 0;
 				if(has_lap_finished()) {
 					toggle_car_colour(1); // Reset car colour
 					powerup_time = 0L; // Reset power up
 					stop_lap_timer(); // Stop timing
-					move_cursor(30,5);
-					printf_P(PSTR("Lap Time: %d.%d second(s)"), get_lap_timer()/10, get_lap_timer()%10);
-					move_cursor(37, 8);
+					set_serial_output_blocking(1);
+					display_lap_time(); // Always show the final time
 					last_lap_timer_update = current_time;
 					handle_new_lap();
+					set_serial_output_blocking(0);
 					// Reset the time of the last scroll
 					last_move_time = get_timer0_clock_ticks();
 				} else {
@@ -396,7 +401,9 @@ void play_game(void) {
 			if(has_car_crashed()) {
 				current_time = get_timer0_clock_ticks();
 				if(!crashed_time) {
+					set_serial_output_blocking(1);
 					set_disp_lives(-1);
+					set_serial_output_blocking(0);
 					crashed_time = current_time;
 				}
 				// Display crashed car
@@ -407,19 +414,33 @@ void play_game(void) {
 					last_move_time = get_timer0_clock_ticks();
 				}
 			}
+
+			// Send the playfield cells that have changed, then any HUD
+			// values that have changed if the serial link has room for them
+			term_flush();
+			update_hud();
 		}
+
+		// Send the game state to the host if in telemetry mode. (This is
+		// done while paused too so the host can show it.)
+		telemetry_update(level);
+
+		// Carry on writing the last lap's log, if there is more of it
+		write_lap_log();
 	}
+	set_serial_output_blocking(1);
 }
 
 void handle_game_over() {
-	// Play sound
+	// Play sound, with the game over animation on the LED matrix (which
+	// carries on until a button is pushed)
 	set_sound_type(2);
+	animation_start(ANIMATION_GAME_OVER);
 	while(is_sound_playing()) {
-		; // Wait until sound finishes playing
+		animation_update(); // Until sound finishes playing
 	}
 
 	// Clear outputs
-	ledmatrix_clear();
 	show_cursor();
 	is_highscore(); // Check if new high score achieved
 	hide_cursor();
@@ -427,14 +448,16 @@ void handle_game_over() {
 
 	set_display_attribute(FG_RED);
 	move_cursor(10,5);
-	// Print a message to the terminal. The spaces on the end of the message
+	// Print a message to the terminal. The spaces after the message
 	// will ensure the "LAP COMPLETE" message is completely overwritten.
-	printf_P(PSTR("GAME OVER   "));
+	put_message(MSG_GAME_OVER);
+	put_spaces(3);
 	normal_display_mode();
 	move_cursor(10,7);
-	printf_P(PSTR("Score: %ld"), get_score());
+	put_message(MSG_SCORE);
+	put_unsigned(get_score());
 	move_cursor(10,10);
-	printf_P(PSTR("Press a button/key to start again"));
+	put_message(MSG_PRESS_TO_RESTART);
 	leaderboard_terminal_output(); // Display leader board
 
 	// Clear a button push or serial input if any are waiting
@@ -442,43 +465,69 @@ void handle_game_over() {
 	(void)button_pushed();
 	clear_serial_input_buffer();
 	while(button_pushed() == -1 && !serial_input_available()) {
-		; // wait until a button has been pushed
+		animation_update(); // wait until a button has been pushed
 	}
+	animation_stop();
 	clear_serial_input_buffer();
 }
 
 void handle_new_lap() {
+	SerialStats link;
+
 	stop_lap_timer();
+
+	// Keep the lap and how the serial link coped, to be logged on the debug
+	// channel over the next passes of the game loop. (The debug channel is
+	// only seen if output is multiplexed.)
+	if(serial_mux_enabled()) {
+		serial_get_stats(&link);
+		term_get_stats(&lap_log_playfield);
+		ledmatrix_get_frame_stats(&lap_log_frames);
+		lap_log_time = get_lap_timer();
+		lap_log_level = level+1;
+		lap_log_sent = link.bytes_sent;
+		lap_log_dropped = link.output_dropped;
+		lap_log_blocked = link.blocked_puts;
+		lap_log_wait = link.wait_ticks;
+		lap_log_line = 1;
+	}
+	term_reset_stats();
+	ledmatrix_reset_frame_stats();
 	set_sound_type(0); // Reset any previous sound to avoid race condition
 	set_sound_type(1);
+	animation_start(ANIMATION_LAP_COMPLETE);
 	while(is_sound_playing()) {
-		; // Wait until sound finishes playing
+		animation_update(); // Until sound finishes playing
 	}
+	// (The flag stays up until the level is shown)
+	animation_stop();
 	clear_terminal();
-	ledmatrix_clear();
 	add_to_score(100); // Reward for completing a lap
 
 	set_display_attribute(FG_GREEN);
 	move_cursor(10,12);
-	printf_P(PSTR("LAP COMPLETE"));
+	put_message(MSG_LAP_COMPLETE);
 	set_display_attribute(FG_YELLOW);
 	move_cursor(10,14);
-	printf_P(PSTR("Level %d"), level+1);
+	put_message(MSG_LEVEL);
+	put_unsigned(level+1);
 	normal_display_mode();
 	move_cursor(10,16);
-	printf_P(PSTR("Score: %ld"), get_score());
+	put_message(MSG_SCORE);
+	put_unsigned(get_score());
 	move_cursor(10,17);
-	printf_P(PSTR("Lap Time: %d.%d second(s)"), get_lap_timer()/10, get_lap_timer()%10);
+	put_message(MSG_LAP_TIME);
+	put_tenths(get_lap_timer());
+	put_message(MSG_SECONDS);
 	// Increase level up till 8 (started from 0)
 	if (level < 8) {
 		level++;
 	}
 
 	// Inform that new lap is starting
-	set_display_attribute(FG_MAGENTA);
-	set_display_attribute(TERM_BRIGHT);
+	set_text_style(FG_MAGENTA, BG_DEFAULT, STYLE(TERM_BRIGHT));
 	move_cursor(10,19);
-	printf_P(PSTR("Loading..."));
+	put_message(MSG_LOADING);
 	normal_display_mode();
 
 	level_splash_screen(); // Show level
@@ -499,13 +548,7 @@ void handle_new_lap() {
 	start_lap_timer();
 
 	// Update HUD
-	set_display_attribute(FG_YELLOW);
-	move_cursor(30,2);
-	printf_P(PSTR("Level %d"), level+1);
-	normal_display_mode();
-	move_cursor(30,4);
-	printf_P(PSTR("Score: %ld"), get_score());
-	move_cursor(37, 8);
+	draw_hud();
 }
 
 // Helper function to convert number of lives to number of LEDs.
@@ -531,6 +574,7 @@ void set_disp_lives(uint8_t num) {
 		set_lives(num);
 	}
 	display_lives();
+	hud_set_lives(get_lives());
 }
 
 /* Reset car to base speed (based on current level).
@@ -539,6 +583,153 @@ void reset_speed(void) {
 	speed = level_speed[level];
 }
 
+/* Update the score in the HUD (only the digits that changed are sent).
+ */
+void display_score(void) {
+	score_dirty = 0;
+	hud_set_score(get_score());
+}
+
+/* Update the lap time in the HUD (only the digits that changed are sent).
+ */
+void display_lap_time(void) {
+	lap_time_dirty = 0;
+	hud_set_lap_time(get_lap_timer());
+}
+
+/* Redraw out of date HUD values, most important first, but only while the
+ * serial link is keeping up (see HUD_BACKLOG_LIMIT).
+ */
+void update_hud(void) {
+	if(score_dirty && serial_output_pending() < HUD_BACKLOG_LIMIT) {
+		display_score();
+	}
+	if(lap_time_dirty && serial_output_pending() < HUD_BACKLOG_LIMIT) {
+		display_lap_time();
+	}
+}
+
+/* Draw the whole HUD (level, lives, score, lap time and pause message)
+ * after the terminal has been cleared.
+ */
+void draw_hud(void) {
+	hud_draw();
+	hud_set_level(level+1);
+	hud_set_lives(get_lives());
+	hud_set_paused(paused);
+	display_score();
+	display_lap_time();
+}
+
+/* Act on a command from the host, if one is waiting. Commands handled by
+ * the serial driver itself (e.g. baud rate changes) never get here.
+ */
+void handle_host_commands(void) {
+	char command, argument;
+
+	if(!serial_host_command(&command, &argument)) {
+		return;
+	}
+	// Commands are rare and may redraw everything, so wait for the
+	// serial link rather than losing any of it
+	set_serial_output_blocking(1);
+	if(command == HOST_COMMAND_OUTPUT_MODE && argument >= '0' &&
+			argument <= '0' + TELEMETRY_ALONGSIDE) {
+		if(telemetry_mode() == TELEMETRY_ONLY && argument != '0' + TELEMETRY_ONLY) {
+			// Back to drawing on the terminal - redraw everything on it
+			set_telemetry_mode(argument - '0');
+			redraw_display();
+			draw_hud();
+		} else {
+			// If switching to telemetry only, the terminal is left as it is
+			set_telemetry_mode(argument - '0');
+		}
+	} else if(command == HOST_COMMAND_HALF_BLOCKS && (argument == '0' || argument == '1')) {
+		// The playfield changes size, so redraw everything (unless the
+		// terminal isn't being drawn on - it is redrawn when it is next)
+		term_set_half_blocks(argument - '0');
+		if(telemetry_mode() != TELEMETRY_ONLY) {
+			redraw_display();
+			draw_hud();
+		}
+	} else if(command == HOST_COMMAND_LED_TIMING && argument >= '0' &&
+			ledmatrix_set_timing(argument - '0')) {
+		// The self-test leaves the LED matrix showing its own picture, so
+		// the game has to be drawn again
+		ledmatrix_self_test();
+		redraw_display();
+		draw_hud();
+		debug_number(PSTR("LED timing "), ledmatrix_get_timing());
+		fputs_P(PSTR("\n"), serial_debug);
+	} else if(command == HOST_COMMAND_REPEAT && (argument == '0' || argument == '1')) {
+		// The terminal does (or doesn't) support REP - used from the
+		// next run of spaces
+		set_terminal_repeat(argument - '0');
+	}
+	set_serial_output_blocking(0);
+}
+
 uint8_t is_paused(void) {
 	return paused;
-}
\ No newline at end of file
+}
+
+/* Write a label (in program memory) then a number on the debug channel.
+ */
+void debug_number(const char* label, uint32_t value) {
+	fputs_P(label, serial_debug);
+	fput_unsigned(value, serial_debug);
+}
+
+/* Write the next line of the lap log (see handle_new_lap()), if there is
+ * one and the debug channel's buffer is empty. No line is longer than
+ * SERIAL_DEBUG_BUFFER_SIZE - 1 bytes, so it is never cut short.
+ */
+void write_lap_log(void) {
+	if(!lap_log_line) {
+		return;
+	}
+	if(!serial_mux_enabled()) {
+		// Nobody is listening any more
+		lap_log_line = 0;
+		return;
+	}
+	if(serial_channel_free(SERIAL_CHANNEL_DEBUG) < SERIAL_DEBUG_BUFFER_SIZE - 1) {
+		return;
+	}
+	switch(lap_log_line) {
+		case 1:
+			fputs_P(PSTR("lap "), serial_debug);
+			fput_tenths(lap_log_time, serial_debug);
+			debug_number(PSTR(" s level "), lap_log_level);
+			break;
+		case 2:
+			debug_number(PSTR("sent "), lap_log_sent);
+			debug_number(PSTR(", dropped "), lap_log_dropped);
+			debug_number(PSTR(", blocked "), lap_log_blocked);
+			debug_number(PSTR(" ("), lap_log_wait);
+			fputs_P(PSTR(" ms)"), serial_debug);
+			break;
+		case 3:
+			debug_number(PSTR("playfield "), lap_log_playfield.bytes);
+			debug_number(PSTR(" bytes, "), lap_log_playfield.scrolls);
+			fputs_P(PSTR(" scrolls"), serial_debug);
+			break;
+		case 4:
+			debug_number(PSTR("last scroll "), lap_log_playfield.last_scroll_bytes);
+			fputs_P(PSTR(" bytes"), serial_debug);
+			break;
+		case 5:
+			debug_number(PSTR("led "), lap_log_frames.frames);
+			debug_number(PSTR(" frames, last "), lap_log_frames.last_bytes);
+			debug_number(PSTR(" bytes in "), lap_log_frames.last_time);
+			fputs_P(PSTR(" us"), serial_debug);
+			break;
+		default:
+			debug_number(PSTR("led max "), lap_log_frames.max_bytes);
+			debug_number(PSTR(" bytes, "), lap_log_frames.max_time);
+			fputs_P(PSTR(" us"), serial_debug);
+			break;
+	}
+	fputs_P(PSTR("\n"), serial_debug);
+	lap_log_line = (lap_log_line == LAP_LOG_LINES) ? 0 : lap_log_line + 1;
+}
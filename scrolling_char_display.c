@@ -21,10 +21,16 @@
  * constants can live just in the program memory and not be 
  * copied to RAM. (This saves several hundred bytes of RAM.)
  *
+ * A message is rendered into a bitmap (one byte per column) when it is
+ * started, and then moved along by text_update() from the main loop as
+ * its time comes, so nothing here waits. Several messages (items) can
+ * scroll at once, each in its own window on the display and at its own
+ * speed.
  */
 
 #include "scrolling_char_display.h"
 #include "ledmatrix.h"
+#include "timer0.h"
 #include <avr/pgmspace.h>
 
 /* FONT DEFINITION
@@ -104,150 +110,194 @@ static const uint8_t* const numbers[10] PROGMEM = {
 		cols_0, cols_1, cols_2, cols_3, cols_4, 
 		cols_5, cols_6, cols_7, cols_8, cols_9 };
 
-/* Keep track of the pixel colour to be used */
-static PixelColour colour = COLOUR_RED;
-
-/* Keep track of which column of data is next to be displayed. 
- * next_col_ptr points to that column, or is 0 if there is
- * no next column.
+/* Text items. Each has its own part of the bitmap (start and length
+ * columns), its window on the display (left and width), its colour and its
+ * speed (milliseconds per column). position counts the columns scrolled
+ * so far - the message has gone once it reaches length + width. due is
+ * when (low 16 bits of the clock tick count) it next moves.
  */
-static volatile const uint8_t* next_col_ptr = 0;
+typedef struct {
+	uint8_t active;
+	uint8_t start;
+	uint8_t length;
+	uint8_t left;
+	uint8_t width;
+	uint8_t speed;
+	PixelColour colour;
+	uint8_t position;
+	uint16_t due;
+} TextItem;
 
-/* String to be displayed. 
- * next_char_to_display will be used to point to the next
- * character from this string to be displayed.
- */
-static char* display_string;
+static TextItem items[TEXT_NUM_ITEMS];
 
-static volatile char* next_char_to_display = 0;
+/* Rendered messages. Each byte is one column of a message, in the same
+ * form as the font data (bit 7 is row 7) with bit 0 clear.
+ */
+static uint8_t bitmap[TEXT_BITMAP_SIZE];
 
-/* Set the colour to be used
+/* Return the font data for a character, or 0 if it has none (it is shown
+ * as a gap).
  */
-void set_text_colour(PixelColour c) {
-	colour = c;
+static const uint8_t* font_columns(char c) {
+	if(c >= 'a' && c <= 'z') {
+		/* Lower case letters are shown as upper case */
+		return (const uint8_t*)pgm_read_word(&letters[c - 'a']);
+	} else if(c >= 'A' && c <= 'Z') {
+		return (const uint8_t*)pgm_read_word(&letters[c - 'A']);
+	} else if(c >= '0' && c <= '9') {
+		return (const uint8_t*)pgm_read_word(&numbers[c - '0']);
+	}
+	return 0;
 }
 
-/*
- * Set the message to be displayed - we just copy the 
- * pointer not the string it points to, so it is important
- * that the original string not change after this function
- * is called while the string is still being displayed.
+/* Return the first bitmap column not used by another active item.
  */
-void set_scrolling_display_text(char* string_to_display) {
-	display_string = string_to_display;
+static uint8_t bitmap_free(uint8_t item) {
+	uint8_t i, end, free = 0;
+
+	for(i = 0; i < TEXT_NUM_ITEMS; i++) {
+		if(i != item && items[i].active) {
+			end = items[i].start + items[i].length;
+			if(end > free) {
+				free = end;
+			}
+		}
+	}
+	return free;
 }
 
-/*
- * Scroll the display. Should be called whenever the display
- * is to be scrolled. 
- * Returns 1 if still scrolling display.
+/* Render a string into the bitmap from column start, stopping at the
+ * end of the bitmap. Each character is a blank column followed by its
+ * font columns. The number of columns is put in *length. Returns 0 if the
+ * string didn't fit.
  */
-uint8_t scroll_display(void) {
-	static uint8_t shift_countdown = 0;
-	uint8_t i;
-	uint8_t col_data;
-	char next_char;
-	uint8_t finished = 0;
-
-	/* Data to be displayed in the next column - by 
-	 * default we show a blank column. Bit 7 of this
-	 * column data corresponds to row 7 of the display
-	 * etc.
-	 */
-	col_data = 0;
-
-	if(next_col_ptr) {
-		/* We're currently outputting a character and next_col_ptr
-		 * points to the display data for the next column. We
-		 * extract that data from program memory.
-		 */
-		col_data = pgm_read_byte(next_col_ptr);
-
-		if(col_data & 1) {
-			/* Least significant bit is set - this is the last
-			 * column of this character
-			 */
-			next_col_ptr = 0;
-		} else {
-			/* This is not the last column of this character - make
-			 * the pointer point to the data for the next column.
-			 */
-			next_col_ptr++;
-		}
-	} else if(next_char_to_display) {
-		/* We're not currently outputting a character, but we
-		 * do have more characters to display. We will output
-		 * a blank column this time (col_data value remains 0)
-		 * but we will set up our pointer (next_col_ptr) so that
-		 * it points to the data for the first column of dots for
-		 * the next character. We first get the next character to be 
-		 * displayed and advance our next character pointer 
-		 * (next_char_to_display) so that it points to the character 
-		 * after.
-		 */
-		next_char = *(next_char_to_display++);
-		if(next_char == 0) {
-			/* We reached the null character at the end of the string.
-			 * There is no next character, reset our pointer to 
-			 * the next character and set our countdown until the 
-			 * message disappears from the display.
-			 */
-			next_char_to_display = 0;
-			shift_countdown = 16;
-		} else if (next_char >= 'a' && next_char <= 'z') {
-			/* Character is a lower case letter - the next column to 
-			 * be displayed will be the first column of the letter
-			 * data for that letter
-			 */
-			next_col_ptr = (const uint8_t*)pgm_read_word(&letters[next_char - 'a']);
-		} else if (next_char >= 'A' && next_char <= 'Z') {
-			/* Upper case character */
-			next_col_ptr = (const uint8_t*)pgm_read_word(&letters[next_char - 'A']);
-		} else if (next_char >= '0' && next_char <= '9') {
-			/* Digit */
-			next_col_ptr = (const uint8_t*)pgm_read_word(&numbers[next_char - '0']);
+static uint8_t render(const char* string, uint8_t start, uint8_t* length) {
+	uint8_t column = start;
+	const uint8_t* font;
+	uint8_t data;
+
+	for(; *string; string++) {
+		if(column == TEXT_BITMAP_SIZE) {
+			*length = column - start;
+			return 0;
 		}
-	} else {
-		/* We're not outputting a column of dots and there is 
-		 * no next character. Move on to the string that we
-		 * have stored (if any).
-		 */
-		if(!display_string) {
-			/* May be finished - flag this and adjust below if we're still
-			 * showing pixels
-			 */
-			finished = 1;
+		bitmap[column++] = 0;
+		font = font_columns(*string);
+		if(!font) {
+			continue;
 		}
-		next_char_to_display = display_string;
-		display_string = 0;
+		do {
+			data = pgm_read_byte(font++);
+			if(column == TEXT_BITMAP_SIZE) {
+				*length = column - start;
+				return 0;
+			}
+			bitmap[column++] = data & 0xFE;
+		} while(!(data & 1));
 	}
-	
-	/* Shift the current display one pixel to the left and insert the 
-	 * new column data at column 15.
-	 * Adjust our "finished" variable if we've finished scrolling the
-	 * message off the display
-	 */
-	ledmatrix_shift_display_left();
+	*length = column - start;
+	return 1;
+}
+
+/* Draw column x of an item's window at its current position.
+ */
+static void draw_column(TextItem* item, uint8_t x) {
 	MatrixColumn column_colour_data;
-	for(i=7; i>=1; i--) {
-		// If the relevant font bit is set, we make this a red pixel, otherwise blank
-		if(col_data & 0x80) {
-			column_colour_data[i] = colour;
-		} else {
-			column_colour_data[i] = 0;
-		}
+	uint8_t y;
+	uint8_t col_data;
+	int16_t column;
+
+	// The message enters from the right of the window
+	column = (int16_t)item->position - item->width + x;
+	col_data = (column >= 0 && column < item->length) ? bitmap[item->start + column] : 0;
+	for(y = 7; y >= 1; y--) {
+		// If the relevant font bit is set, we make this pixel the
+		// item's colour, otherwise blank
+		column_colour_data[y] = (col_data & 0x80) ? item->colour : 0;
 		col_data <<= 1;
 	}
 	column_colour_data[0] = 0;
-	ledmatrix_update_column(15, column_colour_data);
-	if(shift_countdown > 0) {
-		shift_countdown--;
+	ledmatrix_update_column(item->left + x, column_colour_data);
+}
+
+/* Draw an item's whole window at its current position.
+ */
+static void draw(TextItem* item) {
+	uint8_t x;
+
+	for(x = 0; x < item->width; x++) {
+		draw_column(item, x);
 	}
-	finished = finished && (shift_countdown == 0);
-	return !finished;
 }
 
-void clear_prev_msg(void) {
-	next_col_ptr = 0;
-	next_char_to_display = 0;
+uint8_t text_start(uint8_t item, const char* string, PixelColour colour, uint8_t speed,
+		uint8_t left, uint8_t width) {
+	TextItem* t = &items[item];
+	uint8_t fitted;
+
+	t->active = 0;
+	t->start = bitmap_free(item);
+	fitted = render(string, t->start, &t->length);
+	t->left = left;
+	t->width = width;
+	t->speed = speed;
+	t->colour = colour;
+	t->position = 0;
+	t->due = (uint16_t)get_timer0_clock_ticks() + speed;
+	t->active = 1;
+	return fitted;
+}
+
+void text_stop(uint8_t item) {
+	items[item].active = 0;
+}
+
+uint8_t text_scrolling(uint8_t item) {
+	return items[item].active;
+}
+
+void text_set_colour(uint8_t item, PixelColour colour) {
+	items[item].colour = colour;
+}
+
+uint8_t text_update(void) {
+	uint16_t now = get_timer0_clock_ticks();
+	uint8_t i, scrolling = 0, moved = 0;
+	TextItem* t;
+
+	for(i = 0; i < TEXT_NUM_ITEMS; i++) {
+		t = &items[i];
+		if(!t->active) {
+			continue;
+		}
+		if((int16_t)(now - t->due) >= 0) {
+			// Move one column (if we're late, the next move is due
+			// sooner)
+			t->due += t->speed;
+			t->position++;
+			if(!moved) {
+				// All the moves this time are sent as one frame
+				ledmatrix_begin_frame();
+				moved = 1;
+			}
+			if(t->left == 0 && t->width == LED_DISPLAY_COLUMNS) {
+				// The whole display moves - let the LED matrix shift
+				// it, then only the new column has to be drawn
+				ledmatrix_shift_display_left();
+				draw_column(t, t->width - 1);
+			} else {
+				draw(t);
+			}
+			if(t->position >= t->length + t->width) {
+				// Scrolled off the window
+				t->active = 0;
+				continue;
+			}
+		}
+		scrolling++;
+	}
+	if(moved) {
+		ledmatrix_commit_frame();
+	}
+	return scrolling;
 }
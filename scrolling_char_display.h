@@ -10,27 +10,41 @@
 #include <stdint.h>
 #include "pixel_colour.h"
 
-/* Set the colour of all text to be scrolled. If this is called
- * whilst text is scrolling then the colour may change part way
- * through a character. Default colour is red.
+/* Number of messages that can scroll at once, and the number of
+ * columns their rendered text can take between them (a character takes up
+ * to 6).
  */
-void set_text_colour(PixelColour colour);
+#define TEXT_NUM_ITEMS 2
+#define TEXT_BITMAP_SIZE 128
 
-/* Sets the text to be displayed.
+/* Start scrolling a message as the given item (0 to TEXT_NUM_ITEMS - 1),
+ * replacing any message it is showing. The message scrolls from right
+ * to left through display columns left to left + width - 1, moving one
+ * column every speed milliseconds. The string is rendered straight away,
+ * so needn't be kept. Lower case letters are shown as upper case; other
+ * characters that aren't letters or digits are shown as a gap. Returns 0
+ * if there wasn't room for the whole message (it is cut short).
  */
-void set_scrolling_display_text(char* string);
-
-/* Scroll the display. Should be called whenever the display
- * is to be scrolled one pixel to the left. It is recommended that
- * this function NOT be called from an interrupt service routine as
- * it will wait for SPI communication to be finished before returning. 
- * This could take over 1ms.
- * Returns 1 while a message is still scrolling, 0 when done.
+uint8_t text_start(uint8_t item, const char* string, PixelColour colour, uint8_t speed,
+		uint8_t left, uint8_t width);
+
+/* Stop an item scrolling. Its window is left as it is.
+ */
+void text_stop(uint8_t item);
+
+/* Return 1 while an item is scrolling, 0 once its message has scrolled
+ * off (or it was stopped).
  */
-uint8_t scroll_display(void);
+uint8_t text_scrolling(uint8_t item);
 
-/* Clear previous message in queue.
+/* Change an item's colour (from its next move).
  */
-void clear_prev_msg(void);
-	
+void text_set_colour(uint8_t item, PixelColour colour);
+
+/* Move each item that is due to move (by the timer 0 clock) and draw it.
+ * Call this often from the main loop - it never waits (other than for
+ * room in the SPI queue). Returns the number of items still scrolling.
+ */
+uint8_t text_update(void);
+
 #endif /* SCROLLING_CHAR_DISPLAY_H_ */
\ No newline at end of file
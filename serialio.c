@@ -1,7 +1,7 @@
 /*
  * FILE: serialio.c
  *
- * Written by Peter Sutton.
+ * Written by Peter Sutton. Modified by Thuan Song Teoh.
  * 
  * Module to allow standard input/output routines to be used via 
  * serial port 0. The init_serial_stdio() method must be called before
@@ -12,47 +12,175 @@
  * put method will either
  * (1) if interrupts are enabled, block until there is room in it, or
  * (2) if interrupts are disabled, will discard the character.
+ * Received characters are decoded into key codes (see keyboard.h) as
+ * they arrive, so an escape sequence only takes one place in the input
+ * buffer and is never seen half received.
  * Input is blocking - requesting input from stdin will block
  * until a character is available. If interrupts are disabled when 
  * input is sought, then this will block forever.
  * The function input_available() can be used to test whether there is
  * input available to read from stdin.
  *
+ * Both buffers are single producer/single consumer queues. Each index
+ * is only ever written by one side (the main program or an interrupt
+ * handler), so neither side has to turn interrupts off to add or
+ * remove a character.
+ * Constant strings need not be copied into the output buffer at all -
+ * serial_put_P() queues a pointer to the string in program memory and
+ * the interrupt handler reads the characters straight from flash.
+ * Optional XON/XOFF flow control lets the host pause output without
+ * losing any of it (see set_serial_flow_control()).
+ * Output can also be multiplexed into several channels (see serialio.h).
+ * The interrupt handler chooses which channel to send from and adds the
+ * channel tags and escapes as it goes, so callers never need to know
+ * whether multiplexing is on.
+ *
  */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "serialio.h"
+#include "timer0.h"
+#include "keyboard.h"
 
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
 #define SYSCLK 8000000L
 
+/* UBRR values for a given baud rate in normal (16 samples per bit) and
+ * double speed (U2X, 8 samples per bit) mode, rounded to the nearest
+ * integer. (This differs from the datasheet formula so that we get
+ * rounding to the nearest integer while using integer division
+ * (which truncates)). Also the baud rate each really gives and the error
+ * that results, in tenths of a percent.
+ */
+#define UBRR_NORMAL(baud) (((SYSCLK / (8L * (baud))) + 1) / 2 - 1)
+#define UBRR_DOUBLE(baud) (((SYSCLK / (4L * (baud))) + 1) / 2 - 1)
+#define ACTUAL_NORMAL(baud) (SYSCLK / (16L * (UBRR_NORMAL(baud) + 1)))
+#define ACTUAL_DOUBLE(baud) (SYSCLK / (8L * (UBRR_DOUBLE(baud) + 1)))
+#define BAUD_ERROR(actual, baud) ((((actual) - (baud)) * 1000L) / (baud))
+
+/* Table of supported baud rates, with the settings for both modes worked
+ * out at compile time. The host refers to these by their position in the
+ * table (see serialio.h) so the order must not change.
+ */
+typedef struct {
+	uint32_t baud;
+	uint16_t ubrr_normal;
+	uint16_t ubrr_double;
+	int16_t error_normal;
+	int16_t error_double;
+} BaudRateSetting;
+
+#define BAUD_RATE_SETTING(baud) { baud, UBRR_NORMAL(baud), UBRR_DOUBLE(baud), \
+		BAUD_ERROR(ACTUAL_NORMAL(baud), baud), BAUD_ERROR(ACTUAL_DOUBLE(baud), baud) }
+
+static const BaudRateSetting baud_rates[] PROGMEM = {
+	BAUD_RATE_SETTING(9600),
+	BAUD_RATE_SETTING(19200),
+	BAUD_RATE_SETTING(38400),
+	BAUD_RATE_SETTING(57600),
+	BAUD_RATE_SETTING(76800),
+	BAUD_RATE_SETTING(115200),
+	BAUD_RATE_SETTING(250000),
+	BAUD_RATE_SETTING(500000),
+	BAUD_RATE_SETTING(1000000)
+};
+#define NUM_BAUD_RATES (sizeof(baud_rates) / sizeof(baud_rates[0]))
+
+/* Largest acceptable baud rate error (tenths of a percent). Both ends of
+ * the link contribute error, so this should stay well under the 4.5% or
+ * so at which 8 bit frames start to fail.
+ */
+#define DEFAULT_BAUD_TOLERANCE 20
+static uint8_t baud_tolerance = DEFAULT_BAUD_TOLERANCE;
+
 /* Global variables */
-/* Circular buffer to hold outgoing characters. The insert_pos variable
- * keeps track of the position (0 to OUTPUT_BUFFER_SIZE-1) that the next
- * outgoing character should be written to. bytes_in_buffer keeps
- * count of the number of characters currently stored in the buffer 
- * (ranging from 0 to OUTPUT_BUFFER_SIZE). This number of bytes immediately
- * prior to the current insert_pos are the bytes waiting to be output.
- * If the insert_pos reaches the end of the buffer it will wrap around
- * to the beginning (assuming those bytes have been output).
- * NOTE - OUTPUT_BUFFER_SIZE can not be larger than 255 without changing
- * the type of the variables below.
- */
-#define OUTPUT_BUFFER_SIZE 255
+/* Circular buffer to hold outgoing characters. out_head is the position
+ * (0 to OUTPUT_BUFFER_SIZE-1) that the next outgoing character should be
+ * written to and is only changed by uart_put_char(). out_tail is the
+ * position of the next character to be output and is only changed by the
+ * UART Data Register Empty interrupt handler. The buffer is empty when
+ * the two are equal and full when advancing out_head would make them
+ * equal, so OUTPUT_BUFFER_SIZE-1 characters can be waiting at once.
+ * NOTE - OUTPUT_BUFFER_SIZE must be a power of two. Sizes larger than
+ * 256 need 16 bit positions, which the AVR can not read or write in a
+ * single instruction - see out_index_t below.
+ */
+#define OUTPUT_BUFFER_SIZE 256
+#define OUTPUT_BUFFER_MASK (OUTPUT_BUFFER_SIZE - 1)
+
+#if (OUTPUT_BUFFER_SIZE & OUTPUT_BUFFER_MASK) != 0
+#error "OUTPUT_BUFFER_SIZE must be a power of two"
+#endif
+
+#if OUTPUT_BUFFER_SIZE > 256
+/* A 16 bit position is stored one byte at a time, so the interrupt
+ * handler could see half an update. We publish a new out_head inside a
+ * (two instruction) atomic block, and read out_tail until two reads
+ * agree since it may change between the two byte reads.
+ */
+typedef uint16_t out_index_t;
+#define PUBLISH_OUT_HEAD(value) ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { out_head = (value); }
+#else
+typedef uint8_t out_index_t;
+#define PUBLISH_OUT_HEAD(value) out_head = (value)
+#endif
+
 volatile char out_buffer[OUTPUT_BUFFER_SIZE];
-volatile uint8_t out_insert_pos;
-volatile uint8_t bytes_in_out_buffer;
+volatile out_index_t out_head;
+volatile out_index_t out_tail;
 
-/* Circular buffer to hold incoming characters. Works on same principle
- * as output buffer
+/* Queue of spans (strings in flash or RAM) waiting to be output. Each
+ * span remembers the output buffer position (out_pos) that out_head had
+ * when it was queued. The interrupt handler sends the span once out_tail
+ * reaches that position, i.e. after every character that was put in the
+ * output buffer before it, and before any character put there after it.
+ * span_head is only changed by queue_span() and span_tail only by the
+ * ISR. The span currently being sent is copied into the ISR's own
+ * variables (current_span_*) so its queue slot can be reused.
+ */
+#define SPAN_QUEUE_SIZE 16
+#define SPAN_QUEUE_MASK (SPAN_QUEUE_SIZE - 1)
+
+typedef struct {
+	const char* data;
+	uint16_t length;
+	out_index_t out_pos;
+	uint8_t in_flash;
+} OutputSpan;
+
+volatile OutputSpan span_queue[SPAN_QUEUE_SIZE];
+volatile uint8_t span_head;
+volatile uint8_t span_tail;
+
+static const char* current_span_data;
+static volatile uint16_t current_span_remaining;
+static uint8_t current_span_in_flash;
+
+/* Circular buffer to hold incoming key codes. Works on same principle
+ * as output buffer, except that the receive interrupt handler writes
+ * input_head and uart_get_char() writes input_tail. (The timer interrupt
+ * handler also adds to it, through serial_input_tick(), but the two
+ * handlers can never interrupt each other.)
  */
 #define INPUT_BUFFER_SIZE 16
-volatile char input_buffer[INPUT_BUFFER_SIZE];
-volatile uint8_t input_insert_pos;
-volatile uint8_t bytes_in_input_buffer;
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
+
+#if (INPUT_BUFFER_SIZE & INPUT_BUFFER_MASK) != 0 || INPUT_BUFFER_SIZE > 256
+#error "INPUT_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+
+volatile uint8_t input_buffer[INPUT_BUFFER_SIZE];
+volatile uint8_t input_head;
+volatile uint8_t input_tail;
 volatile uint8_t input_overrun;
 
 /* Variable to keep track of whether incoming characters are to be echoed
@@ -60,41 +188,184 @@ volatile uint8_t input_overrun;
  */
 static int8_t do_echo;
 
+/* Echoed characters do not go through the output buffer (the receive
+ * interrupt handler would be a second producer). Instead, one character
+ * can wait here. It is sent ahead of the output buffer contents, but only
+ * between escape sequences (see terminal_state) so it can never land
+ * inside one.
+ */
+static volatile char echo_char;
+static volatile uint8_t echo_pending;
+
+/* Where the terminal channel is in an escape sequence, going by the bytes
+ * sent so far - in plain text, just after ESC (or an ESC and intermediate
+ * bytes), or in a control sequence (ESC [) waiting for its final byte.
+ * Followed by the UDRE interrupt handler. When output is discarded the
+ * sequence being written may never be finished, so the writer puts this
+ * back to plain text - otherwise an echo could wait for a final byte that
+ * never comes.
+ */
+#define TERMINAL_TEXT 0
+#define TERMINAL_ESCAPE 1
+#define TERMINAL_CSI 2
+static volatile uint8_t terminal_state;
+
+/* Replies to host commands (see serialio.h) are sent from this slot,
+ * ahead of everything else. Without multiplexing the reply shares the
+ * terminal's byte stream, so it waits for the end of any escape sequence
+ * being sent (which is sent even while output is otherwise held back).
+ */
+static volatile char reply_char;
+static volatile uint8_t reply_pending;
+
+/* State of the host command currently being received (0 if none) and
+ * its command character.
+ */
+#define HOST_COMMAND_START 1
+#define HOST_COMMAND_ARGUMENT 2
+static uint8_t host_command_state;
+static char command_char;
+
+/* A host command waiting for the program (see serial_host_command()) */
+static volatile uint8_t host_command_waiting;
+static char waiting_command, waiting_argument;
+
+/* A baud rate change requested by the host. Once the reply has been sent
+ * output stops; the change is made when the reply has completely left the
+ * UART (transmit complete interrupt) and output then resumes.
+ */
+static volatile uint8_t baud_change_pending;
+static uint16_t new_ubrr;
+static uint8_t new_double_speed;
+
+/* Buffers for the telemetry and debug channels. These work like the
+ * output buffer but never block: the writer discards what does not fit.
+ */
+typedef struct {
+	volatile char* buffer;
+	uint8_t mask;
+	volatile uint8_t head;
+	volatile uint8_t tail;
+} ChannelBuffer;
+
+#if (SERIAL_TELEMETRY_BUFFER_SIZE & (SERIAL_TELEMETRY_BUFFER_SIZE - 1)) != 0 || \
+		(SERIAL_DEBUG_BUFFER_SIZE & (SERIAL_DEBUG_BUFFER_SIZE - 1)) != 0 || \
+		SERIAL_TELEMETRY_BUFFER_SIZE > 256 || SERIAL_DEBUG_BUFFER_SIZE > 256
+#error "Channel buffer sizes must be powers of two no larger than 256"
+#endif
+
+static volatile char telemetry_buffer[SERIAL_TELEMETRY_BUFFER_SIZE];
+static volatile char debug_buffer[SERIAL_DEBUG_BUFFER_SIZE];
+static ChannelBuffer telemetry_channel = { telemetry_buffer, SERIAL_TELEMETRY_BUFFER_SIZE - 1 };
+static ChannelBuffer debug_channel = { debug_buffer, SERIAL_DEBUG_BUFFER_SIZE - 1 };
+
+/* Multiplexing state. mux_channel is the channel the host was last told
+ * about (MUX_NO_CHANNEL forces a tag before the next byte). A data byte
+ * can turn into as many as four bytes on the wire (tag, channel, escaped
+ * byte), so the extra ones wait in mux_pending and are sent first.
+ */
+#define MUX_NO_CHANNEL 0xFF
+static volatile int8_t mux_enabled;
+static uint8_t mux_channel;
+static char mux_pending[3];
+static uint8_t mux_pending_count;
+static uint8_t mux_pending_next;
+
+/* XON/XOFF flow control. output_stopped is set by the receive interrupt
+ * handler when XOFF arrives and cleared when XON arrives (or the timeout
+ * expires), and stopped_time counts how long (ms) it has been set.
+ */
+static volatile int8_t flow_control;
+static volatile uint8_t output_stopped;
+static uint16_t stopped_time;
+
+/* Whether output waits for buffer space (non-zero, the default) or
+ * discards what does not fit (zero). See set_serial_output_blocking().
+ */
+static int8_t output_blocking;
+
+/* Link health counters (see SerialStats in serialio.h). Each field is
+ * only ever changed by one side - the main program or the interrupt
+ * handlers - so updating them needs no interrupt protection. Only taking
+ * or resetting a snapshot of the whole structure does.
+ */
+static volatile SerialStats stats;
+
 /* Function prototypes 
  */
 void init_serial_stdio(long baudrate, int8_t echo);
+static int queue_byte(char);
 static int uart_put_char(char, FILE*);
 static int uart_get_char(FILE*);
+static void queue_span(const char* data, uint16_t length, uint8_t in_flash);
+static int8_t find_baud_rate(uint8_t index, uint16_t* ubrr, uint8_t* double_speed);
+static void apply_baud_rate(uint16_t ubrr, uint8_t double_speed);
+static int debug_put_char(char, FILE*);
+static void input_add(uint8_t key);
+static void start_output(void);
 
 /* Setup a stream that uses the uart get and put functions. We will
  * make standard input and output use this stream below.
  */
 static FILE myStream = FDEV_SETUP_STREAM(uart_put_char, uart_get_char,
 		_FDEV_SETUP_RW);
+static FILE debugStream = FDEV_SETUP_STREAM(debug_put_char, NULL,
+		_FDEV_SETUP_WRITE);
+FILE* serial_debug = &debugStream;
+
+/* Return the current out_tail value (see the note on out_index_t above).
+ */
+static inline out_index_t read_out_tail(void) {
+#if OUTPUT_BUFFER_SIZE > 256
+	out_index_t tail;
+	do {
+		tail = out_tail;
+	} while(tail != out_tail);
+	return tail;
+#else
+	return out_tail;
+#endif
+}
 
 void init_serial_stdio(long baudrate, int8_t echo) {
-	uint16_t ubrr;
 	/*
 	 * Initialise our buffers
 	*/
-	out_insert_pos = 0;
-	bytes_in_out_buffer = 0;
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
+	out_head = 0;
+	out_tail = 0;
+	input_head = 0;
+	input_tail = 0;
 	input_overrun = 0;
+	echo_pending = 0;
+	terminal_state = TERMINAL_TEXT;
+	output_blocking = 1;
+	span_head = 0;
+	span_tail = 0;
+	current_span_remaining = 0;
+	reply_pending = 0;
+	host_command_state = 0;
+	host_command_waiting = 0;
+	baud_change_pending = 0;
+	telemetry_channel.head = telemetry_channel.tail = 0;
+	debug_channel.head = debug_channel.tail = 0;
+	mux_enabled = 0;
+	mux_pending_count = 0;
+	flow_control = 0;
+	output_stopped = 0;
+	serial_reset_stats();
 	
 	/*
 	 * Record whether we're going to echo characters or not
 	*/
 	do_echo = echo;
 	
-	/* Configure the serial port baud rate */
-	/* (This differs from the datasheet formula so that we get 
-	 * rounding to the nearest integer while using integer division
-	 * (which truncates)).
+	/* Configure the serial port baud rate. Rates in our table get the
+	 * better of normal and double speed mode. Any other rate is set
+	 * up in normal mode, as closely as UBRR allows.
 	*/
-	ubrr = ((SYSCLK / (8 * baudrate)) + 1)/2 - 1;
-	UBRR0 = ubrr;
+	if(set_serial_baudrate(baudrate) != 0) {
+		apply_baud_rate(UBRR_NORMAL(baudrate), 0);
+	}
 	
 	/*
 	 * Enable transmission and receiving via UART. We don't enable
@@ -118,19 +389,90 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 	stdin = &myStream;
 }
 
+int8_t set_serial_baudrate(uint32_t baudrate) {
+	uint16_t ubrr;
+	uint8_t double_speed;
+	uint8_t i;
+
+	for(i = 0; i < NUM_BAUD_RATES; i++) {
+		if(pgm_read_dword(&baud_rates[i].baud) == baudrate) {
+			if(find_baud_rate(i, &ubrr, &double_speed) != 0) {
+				return -1;
+			}
+			apply_baud_rate(ubrr, double_speed);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void set_serial_baud_tolerance(uint8_t tolerance) {
+	baud_tolerance = tolerance;
+}
+
+/* Look up the UBRR value and mode for the baud rate at the given position
+ * in our table. We use whichever mode gives the smaller error, preferring
+ * normal mode (which samples each bit more often) when they are equal.
+ * Returns 0 on success or -1 if the index is invalid or the error is more
+ * than baud_tolerance.
+ */
+static int8_t find_baud_rate(uint8_t index, uint16_t* ubrr, uint8_t* double_speed) {
+	int16_t error_normal, error_double;
+
+	if(index >= NUM_BAUD_RATES) {
+		return -1;
+	}
+	error_normal = abs((int16_t)pgm_read_word(&baud_rates[index].error_normal));
+	error_double = abs((int16_t)pgm_read_word(&baud_rates[index].error_double));
+	if(error_normal <= error_double) {
+		*ubrr = pgm_read_word(&baud_rates[index].ubrr_normal);
+		*double_speed = 0;
+	} else {
+		*ubrr = pgm_read_word(&baud_rates[index].ubrr_double);
+		*double_speed = 1;
+		error_normal = error_double;
+	}
+	if(error_normal > baud_tolerance) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Set the baud rate registers.
+ */
+static void apply_baud_rate(uint16_t ubrr, uint8_t double_speed) {
+	UBRR0 = ubrr;
+	if(double_speed) {
+		UCSR0A |= (1<<U2X0);
+	} else {
+		UCSR0A &= ~(1<<U2X0);
+	}
+}
+
+int8_t serial_host_command(char* command, char* argument) {
+	if(!host_command_waiting) {
+		return 0;
+	}
+	/* The handler won't touch these until we clear the flag */
+	*command = waiting_command;
+	*argument = waiting_argument;
+	host_command_waiting = 0;
+	return 1;
+}
+
 int8_t serial_input_available(void) {
-	return (bytes_in_input_buffer != 0);
+	return (input_head != input_tail);
 }
 
 void clear_serial_input_buffer(void) {
-	/* Just adjust our buffer data so it looks empty */
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
+	/* Just discard everything up to the current insert position. Only
+	 * the reading side changes input_tail so this is safe while the
+	 * receive interrupt handler is adding characters.
+	 */
+	input_tail = input_head;
 }
 
 static int uart_put_char(char c, FILE* stream) {
-	uint8_t interrupts_enabled;
-	
 	/* Add the character to the buffer for transmission (if there 
 	 * is space to do so). If not we wait until the buffer has space.
 	 * If the character is \n, we output \r (carriage return)
@@ -139,108 +481,504 @@ static int uart_put_char(char c, FILE* stream) {
 	if(c == '\n') {
 		uart_put_char('\r', stream);
 	}
-	
+	return queue_byte(c);
+}
+
+/* Add a character to the output buffer without any translation. Returns
+ * 0 on success, 1 if the character had to be discarded.
+ */
+static int queue_byte(char c) {
+	out_index_t next_head;
+	out_index_t waiting;
+	uint32_t wait_start;
+
 	/* If the buffer is full and interrupts are disabled then we
 	 * abort - we don't output the character since the buffer will
-	 * never be emptied if interrupts are disabled. If the buffer is full
+	 * never be emptied if interrupts are disabled. (The same applies
+	 * if output has been made non-blocking.) If the buffer is full
 	 * and interrupts are enabled then we loop until the buffer has 
-	 * enough space. The bytes_in_buffer variable will get modified by the
-	 * ISR which extracts bytes from the buffer.
+	 * enough space. out_tail will get modified by the ISR which
+	 * extracts bytes from the buffer.
 	*/
-	interrupts_enabled = bit_is_set(SREG, SREG_I);
-	while(bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE) {
-		if(!interrupts_enabled) {
+	next_head = (out_head + 1) & OUTPUT_BUFFER_MASK;
+	if(next_head == read_out_tail()) {
+		if(!output_blocking || !bit_is_set(SREG, SREG_I)) {
+			stats.output_dropped++;
+			terminal_state = TERMINAL_TEXT;
 			return 1;
 		}		
-		/* else do nothing */
+		stats.blocked_puts++;
+		wait_start = get_timer0_clock_ticks();
+		while(next_head == read_out_tail()) {
+			/* do nothing */
+		}
+		stats.wait_ticks += get_timer0_clock_ticks() - wait_start;
 	}
 	
-	/* Add the character to the buffer for transmission if there
-	 * is space to do so. We advance the insert_pos to the next
-	 * character position. If this is beyond the end of the buffer
-	 * we wrap around back to the beginning of the buffer 
-	 * NOTE: we disable interrupts before modifying the buffer. This
-	 * prevents the ISR from modifying the buffer at the same time.
-	 * We reenable them if they were enabled when we entered the
-	 * function.
+	/* Store the character and then publish it by advancing out_head.
+	 * (Both are volatile so the compiler can not reorder the two
+	 * writes.) The ISR never looks at the slot until out_head has
+	 * moved past it.
 	*/	
-	cli();
-	out_buffer[out_insert_pos++] = c;
-	bytes_in_out_buffer++;
-	if(out_insert_pos == OUTPUT_BUFFER_SIZE) {
-		/* Wrap around buffer pointer if necessary */
-		out_insert_pos = 0;
-	}
-	/* Reenable interrupts (UDR Empty interrupt may have been
-	 * disabled) */
-	UCSR0B |= (1 << UDRIE0);
-	if(interrupts_enabled) {
-		sei();
+	out_buffer[out_head] = c;
+	PUBLISH_OUT_HEAD(next_head);
+	stats.bytes_queued++;
+	waiting = (next_head - read_out_tail()) & OUTPUT_BUFFER_MASK;
+	if(waiting > stats.output_high_water) {
+		stats.output_high_water = waiting;
 	}
+
+	/* Make sure the UDR Empty interrupt is enabled (it may have
+	 * been disabled when the buffer last became empty). The ISR only
+	 * ever clears this bit after it has seen an empty buffer, so
+	 * setting it after out_head has been updated can not lose a
+	 * character.
+	 */
+	UCSR0B |= (1 << UDRIE0);
 	return 0;
 }
 
+void serial_write(const char* data, uint16_t length) {
+	while(length--) {
+		(void)queue_byte(*data++);
+	}
+}
+
+void serial_put_P(const char* string) {
+	queue_span(string, strlen_P(string), 1);
+}
+
+void serial_put_P_len(const char* string, uint16_t length) {
+	queue_span(string, length, 1);
+}
+
+void serial_put_ram(const char* data, uint16_t length) {
+	queue_span(data, length, 0);
+}
+
+/* Add a span to the span queue. If the queue is full we wait for room,
+ * unless interrupts are disabled (or output is non-blocking) in which case
+ * the bytes are copied into the output buffer instead - all of them if
+ * they fit, otherwise none (so an escape sequence is never cut short).
+ */
+static void queue_span(const char* data, uint16_t length, uint8_t in_flash) {
+	uint8_t next_head;
+	uint8_t waiting;
+	uint32_t wait_start;
+
+	if(length == 0) {
+		return;
+	}
+	next_head = (span_head + 1) & SPAN_QUEUE_MASK;
+	if(next_head == span_tail) {
+		if(!output_blocking || !bit_is_set(SREG, SREG_I)) {
+			if(serial_output_free() < length) {
+				stats.output_dropped += length;
+				terminal_state = TERMINAL_TEXT;
+				return;
+			}
+			while(length--) {
+				(void)queue_byte(in_flash ? pgm_read_byte(data) : *data);
+				data++;
+			}
+			return;
+		}
+		stats.blocked_puts++;
+		wait_start = get_timer0_clock_ticks();
+		while(next_head == span_tail) {
+			/* do nothing */
+		}
+		stats.wait_ticks += get_timer0_clock_ticks() - wait_start;
+	}
+
+	/* Fill in the slot, then publish it by advancing span_head. The
+	 * span follows everything already in the output buffer.
+	 */
+	span_queue[span_head].data = data;
+	span_queue[span_head].length = length;
+	span_queue[span_head].in_flash = in_flash;
+	span_queue[span_head].out_pos = out_head;
+	span_head = next_head;
+	stats.bytes_queued += length;
+	waiting = (next_head - span_tail) & SPAN_QUEUE_MASK;
+	if(waiting > stats.span_high_water) {
+		stats.span_high_water = waiting;
+	}
+
+	UCSR0B |= (1 << UDRIE0);
+}
+
+void set_serial_output_blocking(int8_t blocking) {
+	output_blocking = blocking;
+}
+
+int8_t serial_output_blocking(void) {
+	return output_blocking;
+}
+
+uint16_t serial_output_free(void) {
+	return OUTPUT_BUFFER_MASK - ((out_head - read_out_tail()) & OUTPUT_BUFFER_MASK);
+}
+
+uint16_t serial_output_pending(void) {
+	uint16_t pending;
+	uint16_t span_remaining;
+	uint8_t i;
+
+	/* Characters in the output buffer */
+	pending = (out_head - read_out_tail()) & OUTPUT_BUFFER_MASK;
+
+	/* Spans still in the queue. (The ISR may take one off the queue
+	 * while we look, in which case it is counted twice - this is only
+	 * an estimate.)
+	 */
+	for(i = span_tail; i != span_head; i = (i + 1) & SPAN_QUEUE_MASK) {
+		pending += span_queue[i].length;
+	}
+
+	/* The rest of the span being sent. This is changed by the ISR, so
+	 * read it until two reads agree.
+	 */
+	do {
+		span_remaining = current_span_remaining;
+	} while(span_remaining != current_span_remaining);
+	return pending + span_remaining;
+}
+
+void set_serial_flow_control(int8_t on) {
+	flow_control = on;
+	if(!on) {
+		start_output();
+	}
+}
+
+/* Restart output stopped by XOFF. Only called with interrupts off (from
+ * an interrupt handler or inside an atomic block).
+ */
+static void restart_output(void) {
+	if(output_stopped) {
+		output_stopped = 0;
+		UCSR0B |= (1 << UDRIE0);
+	}
+}
+
+/* As restart_output() but can be called from the main program.
+ */
+static void start_output(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		restart_output();
+	}
+}
+
+void set_serial_mux(int8_t on) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		mux_enabled = on;
+		mux_channel = MUX_NO_CHANNEL;
+	}
+	if(on) {
+		/* Start sending anything already waiting on the other channels */
+		UCSR0B |= (1 << UDRIE0);
+	}
+}
+
+int8_t serial_mux_enabled(void) {
+	return mux_enabled;
+}
+
+/* Return the buffer for the given channel, or NULL if the channel has no
+ * buffer of its own.
+ */
+static ChannelBuffer* channel_buffer(uint8_t channel) {
+	if(channel == SERIAL_CHANNEL_TELEMETRY) {
+		return &telemetry_channel;
+	} else if(channel == SERIAL_CHANNEL_DEBUG) {
+		return &debug_channel;
+	}
+	return NULL;
+}
+
+uint16_t serial_channel_free(uint8_t channel) {
+	ChannelBuffer* cb = channel_buffer(channel);
+
+	if(channel == SERIAL_CHANNEL_TERMINAL ||
+			(channel == SERIAL_CHANNEL_TELEMETRY && !mux_enabled)) {
+		return serial_output_free();
+	}
+	if(!cb) {
+		return 0;
+	}
+	return cb->mask - ((cb->head - cb->tail) & cb->mask);
+}
+
+uint16_t serial_channel_write(uint8_t channel, const char* data, uint16_t length) {
+	ChannelBuffer* cb = channel_buffer(channel);
+	uint16_t written = 0;
+	uint8_t head, next_head;
+
+	if(channel == SERIAL_CHANNEL_TERMINAL ||
+			(channel == SERIAL_CHANNEL_TELEMETRY && !mux_enabled)) {
+		/* Not multiplexed - this goes out with everything else */
+		if(serial_output_free() < length) {
+			length = serial_output_free();
+		}
+		serial_write(data, length);
+		return length;
+	}
+	if(!cb) {
+		return 0;
+	}
+
+	/* Same single producer/single consumer scheme as the output buffer.
+	 * The interrupt handler only takes from this buffer, so we can fill
+	 * it without turning interrupts off.
+	 */
+	head = cb->head;
+	while(written < length) {
+		next_head = (head + 1) & cb->mask;
+		if(next_head == cb->tail) {
+			stats.channel_dropped[channel] += length - written;
+			break;
+		}
+		cb->buffer[head] = data[written++];
+		head = next_head;
+		cb->head = head;
+	}
+	if(written && mux_enabled) {
+		UCSR0B |= (1 << UDRIE0);
+	}
+	return written;
+}
+
+static int debug_put_char(char c, FILE* stream) {
+	(void)stream;
+	return serial_channel_write(SERIAL_CHANNEL_DEBUG, &c, 1) ? 0 : 1;
+}
+
+uint32_t serial_bytes_queued(void) {
+	/* Only changed by the main program, so no protection is needed */
+	return stats.bytes_queued;
+}
+
+void serial_get_stats(SerialStats* snapshot) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*snapshot = *(SerialStats*)&stats;
+	}
+}
+
+void serial_reset_stats(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset((void*)&stats, 0, sizeof(stats));
+	}
+}
+
+uint8_t serial_get_key(void) {
+	uint8_t key;
+
+	if(input_head == input_tail) {
+		return KEY_NONE;
+	}
+	key = input_buffer[input_tail];
+	input_tail = (input_tail + 1) & INPUT_BUFFER_MASK;
+	return key;
+}
+
 int uart_get_char(FILE* stream) {
+	uint8_t c;
+
+	(void)stream;
+
 	/* Wait until we've received a character */
-	while(bytes_in_input_buffer == 0) {
+	while(input_head == input_tail) {
 		/* do nothing */
 	}
 	
 	/*
-	 * Turn interrupts off and remove a character from the input
-	 * buffer. We reenable interrupts if they were on.
-	 * The pending character is the one which is byte_in_input_buffer
-	 * characters before the insert position (taking into account
-	 * that we may need to wrap around).
+	 * Remove the character at the tail of the input buffer. Only
+	 * this function changes input_tail so no interrupt protection
+	 * is needed.
 	 */
-	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
-	cli();
-	char c;
-	if(input_insert_pos - bytes_in_input_buffer < 0) {
-		/* Need to wrap around */
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer
-				+ INPUT_BUFFER_SIZE];
-	} else {
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer];
-	}
-	
-	/* Decrement our count of bytes in the input buffer */
-	bytes_in_input_buffer--;
-	if(interrupts_enabled) {
-		sei();
-	}	
+	c = input_buffer[input_tail];
+	input_tail = (input_tail + 1) & INPUT_BUFFER_MASK;
 	return c;
 }
 
+/* Write a byte that is ready to go (a tag, escape or data byte) to the
+ * UART. If a baud rate change is waiting and this is the last byte of the
+ * reply to the host, ask for an interrupt once it has completely gone.
+ */
+static inline void uart_send(char c) {
+	UDR0 = c;
+	stats.bytes_sent++;
+	if(baud_change_pending && !reply_pending && !mux_pending_count) {
+		/* Clear any old transmit complete flag (by writing a 1 to
+		 * it) so the interrupt fires once this byte has gone. This is
+		 * a plain write rather than a read-modify-write, keeping U2X0
+		 * and writing 0 to the status flags as the datasheet asks.
+		 */
+		UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0);
+		UCSR0B |= (1<<TXCIE0);
+	}
+}
+
+/* Follow the escape sequences in the terminal channel, one byte at a time.
+ */
+static inline void track_terminal(char c) {
+	switch(terminal_state) {
+		case TERMINAL_TEXT:
+			if(c == '\x1b') {
+				terminal_state = TERMINAL_ESCAPE;
+			}
+			break;
+		case TERMINAL_ESCAPE:
+			if(c == '[') {
+				terminal_state = TERMINAL_CSI;
+			} else if(c < 0x20 || c > 0x2F) {
+				/* Not an intermediate byte, so the sequence is over */
+				terminal_state = TERMINAL_TEXT;
+			}
+			break;
+		default:
+			if(c >= 0x40 && c <= 0x7E) {
+				/* Final byte */
+				terminal_state = TERMINAL_TEXT;
+			}
+			break;
+	}
+}
+
+/* Return 1 if a byte can be put into the terminal channel out of order -
+ * the channel is not part way through an escape sequence. (An empty output
+ * buffer is not enough - the rest of the sequence may still be on its way
+ * from the writer.)
+ */
+static inline uint8_t terminal_at_boundary(void) {
+	return terminal_state == TERMINAL_TEXT;
+}
+
+/* Send a data byte for the given channel, tagging and escaping it if
+ * output is multiplexed.
+ */
+static void channel_send(uint8_t channel, char c) {
+	stats.channel_bytes[channel]++;
+	if(channel == SERIAL_CHANNEL_TERMINAL) {
+		track_terminal(c);
+	}
+	if(!mux_enabled) {
+		uart_send(c);
+		return;
+	}
+	mux_pending_next = 0;
+	if(channel != mux_channel) {
+		mux_channel = channel;
+		mux_pending[mux_pending_count++] = '0' + channel;
+		mux_pending[mux_pending_count++] = c;
+		if(c == SERIAL_MUX_ESCAPE) {
+			mux_pending[mux_pending_count++] = c;
+		}
+		stats.mux_overhead += mux_pending_count;
+		c = SERIAL_MUX_ESCAPE;
+	} else if(c == SERIAL_MUX_ESCAPE) {
+		mux_pending[mux_pending_count++] = c;
+		stats.mux_overhead++;
+	}
+	uart_send(c);
+}
+
+/* Take the next byte from a channel buffer, if there is one. Returns 1 if
+ * a byte was taken.
+ */
+static inline uint8_t channel_take(ChannelBuffer* cb, char* c) {
+	if(cb->tail == cb->head) {
+		return 0;
+	}
+	*c = cb->buffer[cb->tail];
+	cb->tail = (cb->tail + 1) & cb->mask;
+	return 1;
+}
+
 /*
  * Define the interrupt handler for UART Data Register Empty (i.e. 
  * another character can be taken from our buffer and written out)
  */
 ISR(USART0_UDRE_vect) 
 {
-	/* Check if we have data in our buffer */
-	if(bytes_in_out_buffer > 0) {
-		/* Yes we do - remove the pending byte and output it
-		 * via the UART. The pending byte (character) is the
-		 * one which is "bytes_in_buffer" characters before the 
-		 * insert_pos (taking into account that we may 
-		 * need to wrap around to the end of the buffer).
+	char c;
+
+	if(mux_pending_count) {
+		/* Finish sending the last tagged or escaped byte */
+		c = mux_pending[mux_pending_next++];
+		if(mux_pending_next == mux_pending_count) {
+			mux_pending_count = 0;
+		}
+		uart_send(c);
+		return;
+	}
+
+	if(reply_pending && (mux_enabled || terminal_at_boundary())) {
+		/* A reply to the host is waiting - send it first */
+		reply_pending = 0;
+		channel_send(SERIAL_CHANNEL_COMMAND, reply_char);
+		return;
+	}
+
+	if((baud_change_pending || output_stopped) && !reply_pending) {
+		/* Hold everything else back until the rate has changed (the
+		 * transmit complete handler reenables this interrupt) or the
+		 * host sends XON (the receive handler reenables it). Replies
+		 * to host commands (above) are still sent while stopped - and
+		 * a reply waiting for the end of an escape sequence lets the
+		 * rest of the sequence through first.
 		 */
-		char c;
-		if(out_insert_pos - bytes_in_out_buffer < 0) {
-			/* Need to wrap around */
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer
-				+ OUTPUT_BUFFER_SIZE];
+		UCSR0B &= ~(1<<UDRIE0);
+		return;
+	}
+
+	if(echo_pending && terminal_at_boundary()) {
+		/* An echoed character is waiting - send it first (unless an
+		 * escape sequence is being sent, in which case the rest of the
+		 * sequence goes first)
+		 */
+		echo_pending = 0;
+		channel_send(SERIAL_CHANNEL_TERMINAL, echo_char);
+		return;
+	}
+
+	if(current_span_remaining == 0 && span_tail != span_head &&
+			span_queue[span_tail].out_pos == out_tail) {
+		/* Everything queued before the next span has been sent - start
+		 * sending the span.
+		 */
+		current_span_data = span_queue[span_tail].data;
+		current_span_remaining = span_queue[span_tail].length;
+		current_span_in_flash = span_queue[span_tail].in_flash;
+		span_tail = (span_tail + 1) & SPAN_QUEUE_MASK;
+	}
+
+	if(current_span_remaining) {
+		/* Output the next character of the span, reading it from
+		 * program memory if necessary.
+		 */
+		if(current_span_in_flash) {
+			c = pgm_read_byte(current_span_data);
 		} else {
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer];
+			c = *current_span_data;
 		}
-		/* Decrement our count of the number of bytes in the 
-		 * buffer 
+		current_span_data++;
+		current_span_remaining--;
+		channel_send(SERIAL_CHANNEL_TERMINAL, c);
+	} else if(out_tail != out_head) {
+		/* We have data in our buffer - remove the pending byte and
+		 * output it via the UART, then advance out_tail (wrapping
+		 * around to the beginning of the buffer if necessary).
 		 */
-		bytes_in_out_buffer--;
-		
-		/* Output the character via the UART */
-		UDR0 = c;
+		c = out_buffer[out_tail];
+		out_tail = (out_tail + 1) & OUTPUT_BUFFER_MASK;
+		channel_send(SERIAL_CHANNEL_TERMINAL, c);
+	} else if(mux_enabled && channel_take(&telemetry_channel, &c)) {
+		/* Terminal is idle - send telemetry, then debug output */
+		channel_send(SERIAL_CHANNEL_TELEMETRY, c);
+	} else if(mux_enabled && channel_take(&debug_channel, &c)) {
+		channel_send(SERIAL_CHANNEL_DEBUG, c);
 	} else {
 		/* No data in the buffer. We disable the UART Data
 		 * Register Empty interrupt because otherwise it 
@@ -252,51 +990,166 @@ ISR(USART0_UDRE_vect)
 	}
 }
 
+/*
+ * Define the interrupt handler for UART Transmit Complete. This is only
+ * enabled while a baud rate change is waiting for the reply to the host
+ * to be sent.
+ */
+ISR(USART0_TX_vect)
+{
+	apply_baud_rate(new_ubrr, new_double_speed);
+	baud_change_pending = 0;
+	UCSR0B = (UCSR0B & ~(1<<TXCIE0)) | (1<<UDRIE0);
+}
+
+/* Handle a character that is part of a host command. Returns 1 if the
+ * character was used, 0 if it should be treated as normal input.
+ */
+static uint8_t host_command(char c) {
+	switch(host_command_state) {
+		case 0:
+			if(c != HOST_COMMAND_CHAR) {
+				return 0;
+			}
+			host_command_state = HOST_COMMAND_START;
+			return 1;
+		case HOST_COMMAND_START:
+			/* Command character - wait for the argument */
+			command_char = c;
+			host_command_state = HOST_COMMAND_ARGUMENT;
+			return 1;
+	}
+
+	/* Argument character - act on the command */
+	host_command_state = 0;
+	if(command_char == HOST_COMMAND_FLOW_CONTROL && (c == '0' || c == '1')) {
+		flow_control = c - '0';
+		if(!flow_control) {
+			restart_output();
+		}
+		reply_char = HOST_REPLY_ACK;
+	} else if(command_char == HOST_COMMAND_MULTIPLEX && (c == '0' || c == '1')) {
+		/* The reply goes out in the new mode */
+		mux_enabled = c - '0';
+		mux_channel = MUX_NO_CHANNEL;
+		reply_char = HOST_REPLY_ACK;
+	} else if(command_char == HOST_COMMAND_BAUD_RATE) {
+		if(!baud_change_pending &&
+				find_baud_rate(c - '0', &new_ubrr, &new_double_speed) == 0) {
+			baud_change_pending = 1;
+			reply_char = HOST_REPLY_ACK;
+		} else {
+			reply_char = HOST_REPLY_NAK;
+		}
+	} else if(!host_command_waiting) {
+		/* Any other command is left for the program to pick up with
+		 * serial_host_command(). There is room for one at a time.
+		 */
+		waiting_command = command_char;
+		waiting_argument = c;
+		host_command_waiting = 1;
+		reply_char = HOST_REPLY_ACK;
+	} else {
+		reply_char = HOST_REPLY_NAK;
+	}
+	reply_pending = 1;
+	UCSR0B |= (1 << UDRIE0);
+	return 1;
+}
+
 /*
  * Define the interrupt handler for UART Receive Complete (i.e. 
- * we can read a character. The character is read and placed in
- * the input buffer.
+ * we can read a character. The character is read, decoded and any
+ * complete key placed in the input buffer.
  */
 
 ISR(USART0_RX_vect) 
 {
-	/* Read the character - we ignore the possibility of overrun. */
+	/* Read the character. If the UART reports a data overrun (a
+	 * character arrived before we read the previous one) we count it
+	 * but otherwise carry on.
+	 */
 	char c;
+	uint8_t key;
+	if(UCSR0A & (1<<DOR0)) {
+		stats.rx_hw_overruns++;
+	}
 	c = UDR0;
+
+	/* Flow control characters take effect straight away. An XOFF
+	 * stops output after the byte currently being sent.
+	 */
+	if(flow_control && c == XOFF) {
+		if(!output_stopped) {
+			output_stopped = 1;
+			stopped_time = 0;
+			stats.xoff_count++;
+		}
+		return;
+	} else if(flow_control && c == XON) {
+		restart_output();
+		return;
+	}
+
+	/* Host commands are acted on here and never reach the input buffer */
+	if(host_command(c)) {
+		return;
+	}
 		
-	if(do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE) {
-		/* If echoing is enabled and there is output buffer
-		 * space, echo the received character back to the UART.
-		 * (If there is no output buffer space, characters
-		 * will be lost.)
+	if(do_echo && echo_pending) {
+		stats.echo_dropped++;
+	} else if(do_echo) {
+		/* If echoing is enabled and the echo slot is free, echo the
+		 * received character back to the UART. (If the slot is still
+		 * waiting to be sent, the character will not be echoed.)
 		 */
-		uart_put_char(c, 0);
+		echo_char = c;
+		echo_pending = 1;
+		UCSR0B |= (1 << UDRIE0);
 	}
 	
-	/* 
-	 * Check if we have space in our buffer. If not, set the overrun
-	 * flag and throw away the character. (We never clear the 
-	 * overrun flag - it's up to the programmer to check/clear
-	 * this flag if desired.)
-	 */
-	if(bytes_in_input_buffer >= INPUT_BUFFER_SIZE) {
+	/* Decode the character. Only complete keys go in the input buffer. */
+	key = key_decode(c);
+	if(key != KEY_NONE) {
+		input_add(key);
+	}
+}
+
+/* Add a key code to the input buffer. If there is no space in it, set the
+ * overrun flag and throw away the key. (We never clear the overrun flag -
+ * it's up to the programmer to check/clear this flag if desired.)
+ */
+static void input_add(uint8_t key) {
+	uint8_t next_head;
+	uint8_t waiting;
+
+	next_head = (input_head + 1) & INPUT_BUFFER_MASK;
+	if(next_head == input_tail) {
 		input_overrun = 1;
+		stats.rx_overruns++;
 	} else {
-		/* If the character is a carriage return, turn it into a
-		 * linefeed 
-		*/
-		if (c == '\r') {
-			c = '\n';
+		input_buffer[input_head] = key;
+		input_head = next_head;
+		waiting = (next_head - input_tail) & INPUT_BUFFER_MASK;
+		if(waiting > stats.input_high_water) {
+			stats.input_high_water = waiting;
 		}
-		
-		/* 
-		 * There is room in the input buffer 
-		 */
-		input_buffer[input_insert_pos++] = c;
-		bytes_in_input_buffer++;
-		if(input_insert_pos == INPUT_BUFFER_SIZE) {
-			/* Wrap around buffer pointer if necessary */
-			input_insert_pos = 0;
+	}
+}
+
+void serial_input_tick(void) {
+	uint8_t key = key_decode_tick();
+
+	/* Time how long output has been stopped by XOFF */
+	if(output_stopped) {
+		stats.throttled_ticks++;
+		if(++stopped_time >= SERIAL_XOFF_TIMEOUT) {
+			stats.xoff_timeouts++;
+			restart_output();
 		}
 	}
+
+	if(key != KEY_NONE) {
+		input_add(key);
+	}
 }
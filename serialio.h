@@ -17,6 +17,62 @@
 #define SERIALIO_H_
 
 #include <stdint.h>
+#include <stdio.h>
+
+/* Output channels. Normally everything written goes straight to the
+ * UART (the terminal channel) and output on the debug channel is held
+ * back. When multiplexing is on (see set_serial_mux()) the channels share
+ * the UART and the host separates them again (see host/serial_mux.c).
+ *
+ * Multiplexed output is a stream of bytes in which SERIAL_MUX_ESCAPE
+ * followed by '0' + channel number means the bytes that follow belong to
+ * that channel, and SERIAL_MUX_ESCAPE SERIAL_MUX_ESCAPE is a single
+ * SERIAL_MUX_ESCAPE byte of data. A tag is only sent when the channel
+ * changes.
+ *
+ * When more than one channel has output waiting, the lowest numbered one
+ * is sent first, so the player's terminal is never held up by
+ * diagnostics. Each channel has its own buffer:
+ *	terminal	stdout and the serial_put_ functions, plus echoed input
+ *	telemetry	SERIAL_TELEMETRY_BUFFER_SIZE bytes
+ *	debug		SERIAL_DEBUG_BUFFER_SIZE bytes
+ *	command		replies to host commands (one at a time)
+ * Output to the telemetry and debug channels never waits - bytes that do
+ * not fit are discarded (and counted).
+ */
+#define SERIAL_CHANNEL_COMMAND 0
+#define SERIAL_CHANNEL_TERMINAL 1
+#define SERIAL_CHANNEL_TELEMETRY 2
+#define SERIAL_CHANNEL_DEBUG 3
+#define SERIAL_NUM_CHANNELS 4
+
+#define SERIAL_MUX_ESCAPE 0x10		// DLE
+#define SERIAL_TELEMETRY_BUFFER_SIZE 64
+#define SERIAL_DEBUG_BUFFER_SIZE 64
+
+/* Counters describing how the serial link is coping. All are zeroed by
+ * init_serial_stdio() and serial_reset_stats(). Times are in timer0 clock
+ * ticks (milliseconds).
+ */
+typedef struct {
+	uint32_t bytes_queued;		// Bytes accepted for output (incl. spans)
+	uint32_t bytes_sent;		// Bytes written to the UART
+	uint16_t blocked_puts;		// Writes that had to wait for room
+	uint32_t wait_ticks;		// Total time those writes waited
+	uint16_t output_dropped;	// Bytes discarded because there was no room
+	uint16_t rx_overruns;		// Received characters lost - input buffer full
+	uint16_t rx_hw_overruns;	// Received characters lost in the UART itself
+	uint16_t echo_dropped;		// Received characters that were not echoed
+	uint16_t output_high_water;	// Most characters ever in the output buffer
+	uint8_t span_high_water;	// Most spans ever waiting in the span queue
+	uint8_t input_high_water;	// Most characters ever in the input buffer
+	uint32_t channel_bytes[SERIAL_NUM_CHANNELS];	// Data bytes sent per channel
+	uint16_t channel_dropped[SERIAL_NUM_CHANNELS];	// Bytes discarded per channel
+	uint32_t mux_overhead;		// Tag and escape bytes sent
+	uint16_t xoff_count;		// Times the host has sent XOFF
+	uint32_t throttled_ticks;	// Total time output was stopped by XOFF
+	uint16_t xoff_timeouts;		// Times output restarted without an XON
+} SerialStats;
 
 /* Initialise serial IO using the UART. baudrate specifies the desired
  * baudrate (e.g. 19200) and echo determines whether incoming characters
@@ -25,14 +81,172 @@
  */
 void init_serial_stdio(long baudrate, int8_t echo);
 
+/* Change the baud rate. Supported rates are 9600, 19200, 38400, 57600,
+ * 76800, 115200, 250000, 500000 and 1000000. The USART double speed mode
+ * is used when it gives a more accurate rate. Returns 0 on success or -1
+ * (leaving the rate unchanged) if the rate is not supported or its error
+ * at our clock speed is above the tolerance. Anything still being sent
+ * will be garbled, so this should only be used while output is idle.
+ */
+int8_t set_serial_baudrate(uint32_t baudrate);
+
+/* Set the largest acceptable baud rate error, in tenths of a percent.
+ * The default is 20 (2%).
+ */
+void set_serial_baud_tolerance(uint8_t tolerance);
+
+/* Host commands. A connected host can send HOST_COMMAND_CHAR followed by
+ * a command character and an argument. These characters are handled by
+ * the receive interrupt handler and never appear as input. The reply
+ * (HOST_REPLY_ACK or HOST_REPLY_NAK) is sent ahead of any other output
+ * (though without multiplexing, not in the middle of an escape sequence).
+ * 
+ * HOST_COMMAND_BAUD_RATE: change baud rate. The argument is a digit
+ * giving the position of the rate in the list above ('0' = 9600,
+ * '1' = 19200, ... '8' = 1000000). The reply is sent at the old rate and
+ * the new rate applies to everything after it.
+ * HOST_COMMAND_FLOW_CONTROL: turn XON/XOFF flow control on ('1') or
+ * off ('0') - see set_serial_flow_control().
+ * HOST_COMMAND_MULTIPLEX: turn multiplexed output on ('1') or off ('0').
+ * The reply to '1' is the first multiplexed output.
+ * Any other command is acknowledged and kept for the program to act on
+ * (see serial_host_command()) - or refused if one is already waiting.
+ */
+#define HOST_COMMAND_CHAR 0x02		// Ctrl-B
+#define HOST_COMMAND_BAUD_RATE 'b'
+#define HOST_COMMAND_MULTIPLEX 'm'
+#define HOST_COMMAND_FLOW_CONTROL 'x'
+#define HOST_COMMAND_OUTPUT_MODE 't'	// See telemetry.h
+#define HOST_COMMAND_HALF_BLOCKS 'h'	// See term.h
+#define HOST_COMMAND_LED_TIMING 'l'		// See ledmatrix.h
+#define HOST_COMMAND_REPEAT 'r'			// See terminalio.h
+#define HOST_REPLY_ACK 0x06
+#define HOST_REPLY_NAK 0x15
+
 /* Test if input is available from the serial port. Return 0 if not,
  * non-zero otherwise.
  */
 int8_t serial_input_available(void);
 
+/* Return the next key code from the input buffer (see keyboard.h), or
+ * KEY_NONE if there isn't one. Never waits. (Reading stdin gives the same
+ * key codes, but waits for one.)
+ */
+uint8_t serial_get_key(void);
+
+/* Must be called every millisecond (from the timer 0 interrupt handler) so
+ * that unfinished escape sequences time out.
+ */
+void serial_input_tick(void);
+
 /* Discard any input waiting to be read from the serial port. (Characters may
  * have been typed when we didn't want them - clear them.
  */
 void clear_serial_input_buffer(void);
 
+/* If the host has sent a command for the program, store the command
+ * and argument characters and return 1, otherwise return 0.
+ */
+int8_t serial_host_command(char* command, char* argument);
+
+/* Output length bytes from RAM exactly as given (no \r is added before
+ * \n), copying them into the output buffer. This is for binary data.
+ */
+void serial_write(const char* data, uint16_t length);
+
+/* Output a string stored in program memory (e.g. from PSTR()) without
+ * copying it into the output buffer. The UART interrupt handler reads the
+ * characters straight from flash, after anything already written to
+ * stdout and before anything written later. Unlike stdout, no \r is added
+ * before \n.
+ */
+void serial_put_P(const char* string);
+
+/* As serial_put_P() but outputs exactly length bytes from program memory.
+ */
+void serial_put_P_len(const char* string, uint16_t length);
+
+/* Output length bytes from RAM without copying them. The bytes are read
+ * by the interrupt handler as they are sent so they must not change until
+ * then - this is intended for data that stays fixed (e.g. stored names).
+ */
+void serial_put_ram(const char* data, uint16_t length);
+
+/* Choose what happens when output does not fit in the output buffer.
+ * If blocking is non-zero (the default), writes wait until the interrupt
+ * handler has made room. If blocking is zero, the characters that do not
+ * fit are discarded so the caller never stalls - callers should check
+ * serial_output_free() first so that escape sequences are not cut short.
+ * (A string from serial_put_P() or serial_put_ram() is kept or discarded
+ * as a whole.) The game is played with output non-blocking.
+ * serial_output_blocking() returns the current choice.
+ */
+void set_serial_output_blocking(int8_t blocking);
+int8_t serial_output_blocking(void);
+
+/* Return the number of characters that can be written to stdout right
+ * now without waiting. (Spans from serial_put_P() and serial_put_ram()
+ * do not use this space.)
+ */
+uint16_t serial_output_free(void);
+
+/* Return (approximately) the number of bytes waiting to be sent,
+ * including those in queued spans. At 19200 baud each byte takes about
+ * 0.5ms to send, so this tells the caller how far behind the link is.
+ */
+uint16_t serial_output_pending(void);
+
+/* Turn XON/XOFF flow control on (non-zero) or off (zero, the default).
+ * While it is on, an XOFF from the host stops output (at the next byte)
+ * until the host sends XON, and neither character is treated as input.
+ * Nothing waits for the XON except writers that find the output buffer
+ * full. If no XON arrives within SERIAL_XOFF_TIMEOUT ms output restarts
+ * anyway, so a lost XON can't stop the program for good.
+ */
+#define XON 0x11		// Ctrl-Q
+#define XOFF 0x13		// Ctrl-S
+#define SERIAL_XOFF_TIMEOUT 2000
+void set_serial_flow_control(int8_t on);
+
+/* Turn multiplexed output on (non-zero) or off (zero).
+ */
+void set_serial_mux(int8_t on);
+
+/* Return non-zero if output is multiplexed.
+ */
+int8_t serial_mux_enabled(void);
+
+/* Return the number of bytes that can be written to the given channel
+ * right now. For the terminal channel this is serial_output_free(). While
+ * multiplexing is off, telemetry output goes to the terminal channel so
+ * this is serial_output_free() for it too.
+ */
+uint16_t serial_channel_free(uint8_t channel);
+
+/* Write length bytes (exactly as given) to the given channel, without
+ * waiting. Returns the number of bytes that fit. Command channel output
+ * is not accepted.
+ */
+uint16_t serial_channel_write(uint8_t channel, const char* data, uint16_t length);
+
+/* Stream for diagnostic output on the debug channel, e.g.
+ * fprintf_P(serial_debug, PSTR("lap %u\n"), lap_time). Never waits. (No \r
+ * is added.)
+ */
+extern FILE* serial_debug;
+
+/* Return the number of bytes accepted for output so far (the same as the
+ * bytes_queued counter, but cheaper to read). Callers can compare two
+ * values to find how many bytes some output took.
+ */
+uint32_t serial_bytes_queued(void);
+
+/* Copy the current link health counters into *snapshot.
+ */
+void serial_get_stats(SerialStats* snapshot);
+
+/* Zero all link health counters (including the high-water marks).
+ */
+void serial_reset_stats(void);
+
 #endif /* SERIALIO_H_ */
\ No newline at end of file
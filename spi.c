@@ -2,11 +2,70 @@
  * spi.c
  *
  * Author: Peter Sutton
+ *
+ * Bytes to send are queued in a circular buffer. The first byte is
+ * written to the SPI data register straight away and each transfer
+ * complete interrupt then sends the next, so the caller never waits for
+ * the (slow) SPI clock unless the queue fills up.
+ *
+ * Gaps and slave select changes (events) are recorded against the queue
+ * position of the byte they have to come before. When that byte is next
+ * to go, the select lines are changed and, for a gap, timer 0's compare
+ * match B is set to go off after the gap - its interrupt handler then
+ * sends the byte instead. Timer 0 counts from 0 to OCR0A every
+ * millisecond, 8 microseconds per count.
  */ 
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "spi.h"
 
+#if (SPI_BUFFER_SIZE & (SPI_BUFFER_SIZE - 1)) != 0 || SPI_BUFFER_SIZE > 256
+#error "SPI_BUFFER_SIZE must be a power of 2 no larger than 256"
+#endif
+
+#if (SPI_NUM_EVENTS & (SPI_NUM_EVENTS - 1)) != 0
+#error "SPI_NUM_EVENTS must be a power of 2"
+#endif
+
+// Pins of port A used for select lines 1 to 3
+#define SELECT_PINS_A ((1<<4)|(1<<5)|(1<<6))
+
+// Transmit queue. The interrupt handler takes bytes from the tail; we add
+// them at the head. busy is 1 while a transfer is in progress.
+static volatile uint8_t spi_buffer[SPI_BUFFER_SIZE];
+static volatile uint8_t spi_head = 0;
+static volatile uint8_t spi_tail = 0;
+static volatile uint8_t spi_busy = 0;
+
+// Events waiting - the queue position of the byte they come before, the
+// gap in timer 0 counts (0 for none) and the select line to change to
+// (NO_SELECT for none). gap_waiting is 1 while a gap is being timed.
+#define NO_SELECT 0xFF
+static volatile uint8_t event_position[SPI_NUM_EVENTS];
+static volatile uint8_t event_counts[SPI_NUM_EVENTS];
+static volatile uint8_t event_select[SPI_NUM_EVENTS];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+static volatile uint8_t gap_waiting = 0;
+
+// Number of select lines set up
+static uint8_t select_lines = 1;
+
+/* Take the given select line low and the others high.
+ */
+static void select_line(uint8_t line) {
+	PORTB |= (1<<4);
+	if(select_lines > 1) {
+		PORTA |= SELECT_PINS_A & ((1<<(3 + select_lines)) - 1);
+	}
+	if(line == 0) {
+		PORTB &= ~(1<<4);
+	} else {
+		PORTA &= ~(1<<(3 + line));
+	}
+}
+
 void spi_setup_master(uint8_t clockdivider) {
 	// Set up SPI communication as a master
 	// Make the SS, MOSI and SCK pins outputs. These are pins
@@ -24,7 +83,8 @@ void spi_setup_master(uint8_t clockdivider) {
 	// Set up the SPI control registers SPCR and SPSR:
 	// - SPE bit = 1 (SPI is enabled)
 	// - MSTR bit = 1 (Master Mode)
-	SPCR0 = (1<<SPE0)|(1<<MSTR0);
+	// - SPIE bit = 1 (SPI transfer complete interrupt enabled)
+	SPCR0 = (1<<SPE0)|(1<<MSTR0)|(1<<SPIE0);
 	
 	// Set SPR0 and SPR1 bits in SPCR and SPI2X bit in SPSR
 	// based on the given clock divider
@@ -55,10 +115,168 @@ void spi_setup_master(uint8_t clockdivider) {
 	}
 	
 	// Take SS (slave select) line low
-	PORTB &= ~(1<<4);
+	select_line(0);
+}
+
+void spi_setup_select_lines(uint8_t count) {
+	uint8_t line, pins = 0;
+
+	select_lines = count;
+	for(line = 1; line < count; line++) {
+		pins |= (1<<(3 + line));
+	}
+	// Outputs, high (not selected)
+	PORTA |= pins;
+	DDRA |= pins;
+}
+
+/* Start sending the next queued byte, if there is one. Called when the
+ * last transfer has completed.
+ */
+static void send_next(void) {
+	uint8_t counts, target;
+
+	while(event_head != event_tail && event_position[event_tail] == spi_tail) {
+		if(event_select[event_tail] != NO_SELECT) {
+			select_line(event_select[event_tail]);
+		}
+		counts = event_counts[event_tail];
+		event_tail = (event_tail + 1) & (SPI_NUM_EVENTS - 1);
+		if(counts) {
+			// Hold the next byte back - it is sent when the compare
+			// match goes off
+			target = TCNT0 + counts;
+			if(target > OCR0A) {
+				target -= OCR0A + 1;
+			}
+			OCR0B = target;
+			TIFR0 = (1<<OCF0B);
+			TIMSK0 |= (1<<OCIE0B);
+			gap_waiting = 1;
+			return;
+		}
+	}
+	if(spi_head != spi_tail) {
+		SPDR0 = spi_buffer[spi_tail];
+		spi_tail = (spi_tail + 1) & (SPI_BUFFER_SIZE - 1);
+	} else {
+		spi_busy = 0;
+	}
+}
+
+/* Called when a gap has finished.
+ */
+static void end_gap(void) {
+	TIMSK0 &= ~(1<<OCIE0B);
+	gap_waiting = 0;
+	send_next();
+}
+
+/* With interrupts off the interrupt handler can't run, so waiting loops
+ * call this to do its job.
+ */
+static void poll_transfer(void) {
+	if(gap_waiting) {
+		if(TIFR0 & (1<<OCF0B)) {
+			TIFR0 = (1<<OCF0B);
+			end_gap();
+		}
+	} else if(SPSR0 & (1<<SPIF0)) {
+		// (Reading SPSR then accessing SPDR clears SPIF)
+		(void)SPDR0;
+		send_next();
+	}
+}
+
+void spi_queue_byte(uint8_t byte) {
+	uint8_t next = (spi_head + 1) & (SPI_BUFFER_SIZE - 1);
+	uint8_t interrupts_on = bit_is_set(SREG, SREG_I);
+
+	while(next == spi_tail) {
+		// Queue full - wait for room
+		if(!interrupts_on) {
+			poll_transfer();
+		}
+	}
+	cli();
+	if(spi_busy) {
+		spi_buffer[spi_head] = byte;
+		spi_head = next;
+	} else {
+		// Nothing being sent - send this straight away
+		spi_busy = 1;
+		SPDR0 = byte;
+	}
+	if(interrupts_on) {
+		sei();
+	}
+}
+
+/* Record an event to happen before the next byte queued.
+ */
+static void queue_event(uint8_t counts, uint8_t line) {
+	uint8_t next = (event_head + 1) & (SPI_NUM_EVENTS - 1);
+	uint8_t interrupts_on = bit_is_set(SREG, SREG_I);
+
+	while(next == event_tail) {
+		// Too many events waiting - wait for one to happen
+		if(!interrupts_on) {
+			poll_transfer();
+		}
+	}
+	cli();
+	event_position[event_head] = spi_head;
+	event_counts[event_head] = counts;
+	event_select[event_head] = line;
+	event_head = next;
+	if(!spi_busy) {
+		// Nothing being sent - the event happens now (a gap is timed from
+		// now, as the last byte may only just have gone)
+		spi_busy = 1;
+		send_next();
+	}
+	if(interrupts_on) {
+		sei();
+	}
+}
+
+void spi_queue_gap(uint16_t microseconds) {
+	uint16_t counts;
+
+	if(microseconds == 0) {
+		return;
+	}
+	// Round up to whole counts, plus one as the current count is
+	// already part way through
+	counts = (microseconds + 7) / 8 + 1;
+	if(counts > OCR0A) {
+		counts = OCR0A;
+	}
+	queue_event(counts, NO_SELECT);
+}
+
+void spi_queue_select(uint8_t line) {
+	queue_event(0, line);
+}
+
+void spi_flush(void) {
+	uint8_t interrupts_on = bit_is_set(SREG, SREG_I);
+
+	while(spi_busy) {
+		if(!interrupts_on) {
+			poll_transfer();
+		}
+	}
 }
 
 uint8_t spi_send_byte(uint8_t byte) {
+	uint8_t received;
+
+	// Send anything queued, then stop the interrupt handler seeing this
+	// transfer complete
+	spi_flush();
+	SPCR0 &= ~(1<<SPIE0);
+
 	// Write out the byte to the SPDR register. This will initiate
 	// the transfer. We then wait until the most significant byte of
 	// SPSR (SPIF bit) is set - this indicates that the transfer is
@@ -69,5 +287,15 @@ uint8_t spi_send_byte(uint8_t byte) {
 	while((SPSR0 & (1<<SPIF0)) == 0) {
 		; // wait
 	}
-	return SPDR0;
+	received = SPDR0;
+	SPCR0 |= (1<<SPIE0);
+	return received;
+}
+
+ISR(SPI_STC_vect) {
+	send_next();
+}
+
+ISR(TIMER0_COMPB_vect) {
+	end_gap();
 }
\ No newline at end of file
@@ -9,10 +9,43 @@
 
 // Set up SPI communication as a master.
 // clockdivider should be one of 2,4,8,16,32,64,128
+// Slave select line 0 is selected.
 void spi_setup_master(uint8_t clockdivider);
 
-// Send and receive an SPI byte. This function will take at least 8 
-// cyles of the divided clock
+// Slave select lines, for more than one slave. Line 0 is the SS pin (pin 4
+// of port B); lines 1 to 3 are pins 4 to 6 of port A. spi_setup_master()
+// only sets up line 0 - this sets up lines 1 to count - 1 as well (count
+// is no more than SPI_NUM_SELECT_LINES).
+#define SPI_NUM_SELECT_LINES 4
+void spi_setup_select_lines(uint8_t count);
+
+// Size of the transmit queue (a power of 2, no more than 256)
+#define SPI_BUFFER_SIZE 64
+
+// Queue a byte to be sent. Bytes are sent in order by the SPI transfer
+// complete interrupt handler, so this returns straight away unless the
+// queue is full (when it waits for room).
+void spi_queue_byte(uint8_t byte);
+
+// Leave a gap of at least the given number of microseconds (up to about
+// 990) between the last byte queued and the next one, e.g. to give the
+// receiver time to act on a command. Timed with timer 0 (see timer0.h),
+// which must be running.
+void spi_queue_gap(uint16_t microseconds);
+
+// Select a different slave (see above) once the bytes queued so far have
+// been sent.
+void spi_queue_select(uint8_t line);
+
+// Up to SPI_NUM_EVENTS gaps and select changes can be waiting at once -
+// after that the functions above wait for one to happen.
+#define SPI_NUM_EVENTS 8
+
+// Wait until every queued byte has been sent (and any gap has finished)
+void spi_flush(void);
+
+// Send and receive an SPI byte. Any queued bytes are sent first. This
+// function will take at least 8 cyles of the divided clock
 uint8_t spi_send_byte(uint8_t byte);
 
 #endif /* SPI_H_ */
\ No newline at end of file
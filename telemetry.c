@@ -0,0 +1,172 @@
+/*
+ * telemetry.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Builds and sends the binary telemetry frames described in telemetry.h.
+ * A scroll costs one 19 byte frame, compared with well over 100 bytes of
+ * escape sequences to redraw the same changes on the terminal.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#include "telemetry.h"
+#include "serialio.h"
+#include "game.h"
+#include "score.h"
+#include "timer1.h"
+#include "project.h"
+
+// Frame header length (sync, type, sequence, length) and total length of
+// the largest frame
+#define HEADER_LENGTH 4
+#define MAX_FRAME_LENGTH (HEADER_LENGTH + TELEMETRY_MAX_PAYLOAD + 1)
+
+// Telemetry mode (TELEMETRY_OFF, TELEMETRY_ONLY or TELEMETRY_ALONGSIDE)
+static uint8_t mode = TELEMETRY_OFF;
+
+// Sequence number of the next frame
+static uint8_t sequence;
+
+// Flag to send a full frame next time (1 yes, 0 no)
+static uint8_t full_frame_needed;
+
+// What the host was last sent - the scroll position and state block
+static uint8_t sent_scroll_position;
+static uint8_t sent_state[TELEMETRY_STATE_LENGTH];
+
+// Frame being built
+static uint8_t frame[MAX_FRAME_LENGTH];
+
+void set_telemetry_mode(uint8_t new_mode) {
+	mode = new_mode;
+	full_frame_needed = 1;
+}
+
+uint8_t telemetry_mode(void) {
+	return mode;
+}
+
+void telemetry_request_full_frame(void) {
+	full_frame_needed = 1;
+}
+
+/* Fill in the state block at the given position.
+ */
+static void build_state(uint8_t* state, uint8_t level) {
+	uint8_t flags = 0;
+	uint32_t score = get_score();
+	uint16_t lap_time = get_lap_timer();
+	int8_t powerup_row = get_powerup_row();
+
+	if(has_car_crashed()) {
+		flags |= TELEMETRY_FLAG_CRASHED;
+	}
+	if(powerup_status()) {
+		flags |= TELEMETRY_FLAG_POWERED_UP;
+	}
+	if(get_powerup_colour() == COLOUR_POWERUP) {
+		flags |= TELEMETRY_FLAG_POWERUP_LIT;
+	}
+	if(get_car_colour() == COLOUR_POWERUP) {
+		flags |= TELEMETRY_FLAG_CAR_LIT;
+	}
+	if(is_paused()) {
+		flags |= TELEMETRY_FLAG_PAUSED;
+	}
+
+	state[0] = get_car_column();
+	state[1] = flags;
+	// (With a wider LED matrix the power-up can be above the rows sent)
+	state[2] = powerup_row < TELEMETRY_NUM_ROWS ? powerup_row : -1;
+	state[3] = get_powerup_column();
+	state[4] = get_lives();
+	state[5] = level + 1;
+	state[6] = score;
+	state[7] = score >> 8;
+	state[8] = score >> 16;
+	state[9] = score >> 24;
+	state[10] = lap_time;
+	state[11] = lap_time >> 8;
+}
+
+/* Add the header and check byte to the payload already in the frame and
+ * send it. Returns 1 if the frame was sent, 0 if there was no room for it
+ * in the serial output buffer.
+ */
+static uint8_t send_frame(uint8_t type, uint8_t length) {
+	uint8_t total = HEADER_LENGTH + length + 1;
+	uint8_t check = 0;
+	uint8_t i;
+
+	if(serial_channel_free(SERIAL_CHANNEL_TELEMETRY) < total) {
+		return 0;
+	}
+	frame[0] = TELEMETRY_SYNC;
+	frame[1] = type;
+	frame[2] = sequence++;
+	frame[3] = length;
+	for(i = 1; i < HEADER_LENGTH + length; i++) {
+		check = _crc8_ccitt_update(check, frame[i]);
+	}
+	frame[HEADER_LENGTH + length] = check;
+	serial_channel_write(SERIAL_CHANNEL_TELEMETRY, (const char*)frame, total);
+	return 1;
+}
+
+void telemetry_update(uint8_t level) {
+	uint8_t* payload = &frame[HEADER_LENGTH];
+	uint8_t scroll_position;
+	uint8_t scrolled;
+	uint8_t sent;
+	uint8_t row;
+	uint16_t line_rows;
+
+	if(!mode) {
+		return;
+	}
+
+	scroll_position = get_scroll_position();
+	scrolled = scroll_position - sent_scroll_position;
+
+	if(full_frame_needed || scrolled > 1) {
+		// Send the whole playfield
+		line_rows = 0;
+		for(row = 0; row < TELEMETRY_NUM_ROWS; row++) {
+			payload[row] = get_background_data(row);
+			if(is_start_or_finish_row(row)) {
+				line_rows |= (1 << row);
+			}
+		}
+		payload[TELEMETRY_NUM_ROWS] = line_rows;
+		payload[TELEMETRY_NUM_ROWS + 1] = line_rows >> 8;
+		build_state(&payload[TELEMETRY_NUM_ROWS + 2], level);
+		sent = send_frame(TELEMETRY_FRAME_FULL, TELEMETRY_NUM_ROWS + 2 + TELEMETRY_STATE_LENGTH);
+		row = TELEMETRY_NUM_ROWS + 2;
+	} else if(scrolled == 1) {
+		// Send just the new top row
+		payload[0] = get_background_data(TELEMETRY_NUM_ROWS - 1);
+		payload[1] = is_start_or_finish_row(TELEMETRY_NUM_ROWS - 1);
+		build_state(&payload[2], level);
+		sent = send_frame(TELEMETRY_FRAME_SCROLL, 2 + TELEMETRY_STATE_LENGTH);
+		row = 2;
+	} else {
+		// Only send the state if it has changed
+		build_state(payload, level);
+		if(memcmp(payload, sent_state, TELEMETRY_STATE_LENGTH) == 0) {
+			return;
+		}
+		sent = send_frame(TELEMETRY_FRAME_STATE, TELEMETRY_STATE_LENGTH);
+		row = 0;
+	}
+
+	// Remember what the host has been sent. (If the frame couldn't be
+	// sent we try again next time.)
+	if(sent) {
+		full_frame_needed = 0;
+		sent_scroll_position = scroll_position;
+		memcpy(sent_state, &payload[row], TELEMETRY_STATE_LENGTH);
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * telemetry.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Binary telemetry output - an alternative to drawing the game on the
+ * terminal with escape sequences. In the TELEMETRY_ONLY mode the
+ * terminal playfield and HUD are not drawn. Instead compact frames
+ * describing the game are sent and a program on the host (see
+ * host/telemetry_view.c) draws the game from them. In the
+ * TELEMETRY_ALONGSIDE mode the terminal is drawn as well - this is meant
+ * for use with multiplexed output (see serialio.h), where the frames go
+ * on their own channel and don't disturb the terminal.
+ *
+ * The mode is chosen by the host command HOST_COMMAND_OUTPUT_MODE (see
+ * serialio.h) with argument '0' + mode.
+ *
+ * Frame format (multi-byte values are little endian):
+ *	TELEMETRY_SYNC
+ *	type			One of the TELEMETRY_FRAME_ values below
+ *	sequence		Goes up by one for every frame sent
+ *	length			Number of payload bytes
+ *	payload
+ *	check			CRC-8 (polynomial 0x07, initial value 0) of the
+ *					type, sequence, length and payload bytes
+ *
+ * Payloads:
+ *	TELEMETRY_FRAME_FULL	16 background bytes (game row 0 first, bit n
+ *							set if there is background in column n),
+ *							2 byte mask of the rows that are the start or
+ *							finish line, then the state block
+ *	TELEMETRY_FRAME_SCROLL	The playfield scrolled down one row. The
+ *							background byte for the new row 15, 1 if it is
+ *							the start/finish line (0 otherwise), then the
+ *							state block
+ *	TELEMETRY_FRAME_STATE	The state block only
+ *
+ * The state block is TELEMETRY_STATE_LENGTH bytes:
+ *	car column (the car is on game rows 1 and 2), flags (TELEMETRY_FLAG_
+ *	values), power-up row (-1 if not on game rows 0 to 15), power-up
+ *	column, lives, level (1 to 9), score (4 bytes), lap time in tenths
+ *	of a second (2 bytes)
+ *
+ * Frames are written to the telemetry channel (SERIAL_CHANNEL_TELEMETRY).
+ * If a frame can't be sent because the serial link is behind, it is not
+ * sent at all. When the link catches up a full frame is sent if any
+ * scroll was missed, so the host never draws a wrong playfield.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#define TELEMETRY_OFF 0
+#define TELEMETRY_ONLY 1
+#define TELEMETRY_ALONGSIDE 2
+
+#define TELEMETRY_SYNC 0xA5
+
+#define TELEMETRY_FRAME_FULL 0x01
+#define TELEMETRY_FRAME_SCROLL 0x02
+#define TELEMETRY_FRAME_STATE 0x03
+
+#define TELEMETRY_NUM_ROWS 16
+#define TELEMETRY_STATE_LENGTH 12
+#define TELEMETRY_MAX_PAYLOAD (TELEMETRY_NUM_ROWS + 2 + TELEMETRY_STATE_LENGTH)
+
+#define TELEMETRY_FLAG_CRASHED 0x01
+#define TELEMETRY_FLAG_POWERED_UP 0x02
+#define TELEMETRY_FLAG_POWERUP_LIT 0x04		// Power-up pixel is on (it blinks)
+#define TELEMETRY_FLAG_CAR_LIT 0x08			// Car shown in power-up colour
+#define TELEMETRY_FLAG_PAUSED 0x10
+
+/* Set the telemetry mode (TELEMETRY_OFF, TELEMETRY_ONLY or
+ * TELEMETRY_ALONGSIDE). Turning it on sends a full frame at the next
+ * telemetry_update().
+ */
+void set_telemetry_mode(uint8_t new_mode);
+
+/* Return the telemetry mode.
+ */
+uint8_t telemetry_mode(void);
+
+/* Make the next telemetry_update() send a full frame (e.g. after the
+ * playfield has been reset).
+ */
+void telemetry_request_full_frame(void);
+
+/* Send a frame if anything has changed since the last one. Should be
+ * called regularly from the game loop. level is the current level
+ * (counting from 0).
+ */
+void telemetry_update(uint8_t level);
+
+#endif /* TELEMETRY_H_ */
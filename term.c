@@ -4,11 +4,36 @@
  * Author: Thuan Song Teoh
  *
  * Methods to convert LED matrix output to terminal
- * output. Note that after every output, cursor is moved back
- * to row 8 to ensure scroll_down() works. Background and car
- * are represented by coloured whitespaces. Power-up is a blinking green 'P'.
- * This is essentially a plugin since no major changes to original code required,
- * apart from remembering to move moved back to row 8 after every output.
+ * output. Background and car are represented by coloured whitespaces.
+ * Power-up is a green whitespace that blinks.
+ * This is essentially a plugin since no major changes to original code required.
+ *
+ * The term_ drawing functions don't send anything themselves. They
+ * record the colour each playfield cell should be, and term_flush() then
+ * sends only the cells whose colour differs from what the terminal is
+ * already showing. Changed cells close together on a row are sent as one
+ * run, so the cursor only has to be moved once per run (move_cursor()
+ * then picks the cheapest way to get to the next run). term_scroll_down()
+ * is the exception - it scrolls the terminal straight away (which is much
+ * cheaper than redrawing the playfield) and scrolls the record to match.
+ * Nothing is output while in the TELEMETRY_ONLY mode (see telemetry.h) -
+ * the host draws the game from the telemetry frames instead.
+ *
+ * While serial output is non-blocking (as it is during the game) nothing
+ * here waits for the serial link. term_flush() only starts a run of cells
+ * if the output buffer has room for all of it, and leaves the rest for
+ * the next flush. If there isn't room to scroll the terminal, the
+ * playfield is marked as unknown instead so term_flush() redraws it.
+ *
+ * In half block mode each terminal cell shows two game rows, as the top
+ * and bottom halves of a half block character. Which two rows share a cell
+ * alternates (the phase) - when the game scrolls by one row the phase
+ * changes instead, and the terminal is left as it is. On the next scroll
+ * the phase changes back and the terminal scrolls by one line. So the
+ * terminal only scrolls every second row, and the playfield takes
+ * HALF_LINES lines (one more than half the rows, as with phase 1 the
+ * bottom line shows a row below the playfield and the top line a row
+ * above it, both always black).
  */
 
 #include <avr/io.h>
@@ -19,97 +44,365 @@
 #include "terminalio.h"
 #include "term.h"
 #include "game.h"
+#include "serialio.h"
+#include "telemetry.h"
+
+// Position of the playfield on the terminal. Game row 0 is on the bottom
+// line and game column 0 on the left.
+#define PLAYFIELD_LEFT 37
+#define PLAYFIELD_BOTTOM 23
+#define PLAYFIELD_TOP (PLAYFIELD_BOTTOM - NUM_ROWS + 1)
+#define NUM_ROWS TERM_NUM_ROWS
+#define NUM_COLUMNS 8
+#define HALF_LINES (NUM_ROWS / 2 + 1)
+#define HALF_TOP (PLAYFIELD_BOTTOM - HALF_LINES + 1)
+
+// Cell colours
+#define CELL_BLACK 0
+#define CELL_BACKGROUND 1
+#define CELL_FINISH_LINE 2
+#define CELL_CAR 3
+#define CELL_CRASH 4
+#define CELL_POWERUP 5
+#define CELL_UNKNOWN 0x0F	// Shown colour when the terminal may show anything
+
+// Background colour for each cell colour
+static const uint8_t cell_background[] PROGMEM = {
+	BG_DEFAULT, BG_BLUE, BG_WHITE, BG_YELLOW, BG_RED, BG_GREEN
+};
+
+// Approximate cost (bytes) of changing the colour between two cells
+#define COLOUR_CHANGE_COST 5
+
+// Most bytes a cursor move, a colour change (to playfield colours or back
+// to normal) and one run of cells, one half block cell or a scroll can
+// take. Used to check there is room in the output buffer before starting.
+#define MOVE_MAX_BYTES 8
+#define STYLE_MAX_BYTES 10
+#define RUN_MAX_BYTES (MOVE_MAX_BYTES + NUM_COLUMNS * (STYLE_MAX_BYTES + 1))
+#define HALF_CELL_MAX_BYTES (MOVE_MAX_BYTES + STYLE_MAX_BYTES + 3)
+#define SCROLL_MAX_BYTES (MOVE_MAX_BYTES + 2)
+
+/* Playfield record. The low nibble of each cell is the colour it should
+ * be and the high nibble the colour the terminal is showing.
+ */
+#define WANTED(cell) ((cell) & 0x0F)
+#define SHOWN(cell) ((cell) >> 4)
+static uint8_t cells[NUM_ROWS][NUM_COLUMNS];
+
+// Half block mode (see above). below[] is the colour shown for the row
+// below the playfield (in phase 1).
+static uint8_t half_blocks = 0;
+static uint8_t phase;
+static uint8_t below[NUM_COLUMNS];
+
+// Playfield output counters (see term.h), and the byte count when the
+// playfield last scrolled
+static TermStats stats;
+static uint32_t bytes_at_last_scroll;
+
+/* Return 1 if bytes more bytes can be output without waiting or being
+ * discarded (or output waits for room anyway).
+ */
+static uint8_t room_for(uint8_t bytes) {
+	return serial_output_blocking() || serial_output_free() >= bytes;
+}
+
+/* Forget what the terminal is showing, so every cell is sent again.
+ */
+static void forget_shown(void) {
+	uint8_t row, column;
+
+	for(row = 0; row < NUM_ROWS; row++) {
+		for(column = 0; column < NUM_COLUMNS; column++) {
+			cells[row][column] |= CELL_UNKNOWN << 4;
+		}
+	}
+	memset(below, CELL_UNKNOWN, NUM_COLUMNS);
+}
+
+/* Set the colour a cell should be.
+ */
+static void set_cell(uint8_t row, uint8_t column, uint8_t colour) {
+	cells[row][column] = (cells[row][column] & 0xF0) | colour;
+}
+
+/* Return non-zero if the cell needs to be sent.
+ */
+static uint8_t cell_changed(uint8_t row, uint8_t column) {
+	uint8_t cell = cells[row][column];
+	return WANTED(cell) != SHOWN(cell);
+}
+
+/* Return the cost (bytes) of sending cells from to to-1 of a row again,
+ * following cell from-1.
+ */
+static uint8_t resend_cost(uint8_t row, uint8_t from, uint8_t to) {
+	uint8_t cost = 0;
+	uint8_t previous = WANTED(cells[row][from - 1]);
+	uint8_t colour;
+
+	for(; from < to; from++) {
+		colour = WANTED(cells[row][from]);
+		cost += 1 + (colour != previous ? COLOUR_CHANGE_COST : 0);
+		previous = colour;
+	}
+	return cost;
+}
+
+/* The colour row (which may be just outside the playfield) should be and
+ * the colour the terminal is showing for it, in half block mode. Rows
+ * outside the playfield should be black.
+ */
+static uint8_t half_wanted(int8_t row, uint8_t column) {
+	return (row >= 0 && row < NUM_ROWS) ? WANTED(cells[row][column]) : CELL_BLACK;
+}
+
+static uint8_t half_shown(int8_t row, uint8_t column) {
+	if(row < 0) {
+		return below[column];
+	}
+	return row < NUM_ROWS ? SHOWN(cells[row][column]) : CELL_BLACK;
+}
+
+/* Send the terminal cells that have changed in half block mode.
+ */
+static void flush_half_blocks(void) {
+	uint8_t line, column;
+	int8_t lower;
+	uint8_t lower_colour, upper_colour;
+
+	for(line = 0; line < HALF_LINES; line++) {
+		lower = 2 * line - phase;
+		for(column = 0; column < NUM_COLUMNS; column++) {
+			lower_colour = half_wanted(lower, column);
+			upper_colour = half_wanted(lower + 1, column);
+			if(lower_colour == half_shown(lower, column) &&
+					upper_colour == half_shown(lower + 1, column)) {
+				continue;
+			}
+			if(!room_for(HALF_CELL_MAX_BYTES + STYLE_MAX_BYTES)) {
+				return;	// The rest is sent next time
+			}
+			// (No cursor movement is sent if this follows the last cell
+			// sent)
+			move_cursor(PLAYFIELD_LEFT + column, PLAYFIELD_BOTTOM - line);
+			put_half_blocks(pgm_read_byte(&cell_background[upper_colour]),
+					pgm_read_byte(&cell_background[lower_colour]));
+			if(lower < 0) {
+				below[column] = lower_colour;
+			} else {
+				cells[lower][column] = (lower_colour << 4) | lower_colour;
+			}
+			if(lower + 1 < NUM_ROWS) {
+				cells[lower + 1][column] = (upper_colour << 4) | upper_colour;
+			}
+		}
+	}
+}
 
 /* Does the same thing as redraw_game_row() in game.c.
  */
 void term_redraw_game_row(uint8_t row) {
+	if(row >= NUM_ROWS) {
+		return;
+	}
 	// Obtain row data
 	uint8_t background_row_data = get_background_data(row);
 	uint8_t i;
-	move_cursor(37,23 - row);
 	for(i=0;i<=7;i++) {
 		if(background_row_data & (1<<i)) {
 			// Bit i is set, meaning background is present
-			set_display_attribute(BG_BLUE);
-			printf_P(PSTR(" "));
-			normal_display_mode();
+			set_cell(row, i, CELL_BACKGROUND);
 		} else {
-			printf_P(PSTR(" "));
+			set_cell(row, i, CELL_BLACK);
 		}
 	}
-	move_cursor(37,8);
 }
 
 /* Does the same thing as draw_start_or_finish_line() in game.c.
  */
 void term_draw_start_or_finish_line(uint8_t row) {
+	uint8_t i;
+	if(row >= NUM_ROWS) {
+		return;
+	}
 	// Draw a white line
-	set_display_attribute(BG_WHITE);
-	move_cursor(37,23-row);
-	printf_P(PSTR("        "));
-	normal_display_mode();
-	move_cursor(37,8);
+	for(i=0;i<=7;i++) {
+		set_cell(row, i, CELL_FINISH_LINE);
+	}
 }
 
 /* Does the same thing as redraw_car() in game.c.
  */
 void term_redraw_car(uint8_t colr, uint8_t column) {
 	// Normal colour
-	set_display_attribute(BG_YELLOW);
+	uint8_t colour = CELL_CAR;
 	if(colr == COLOUR_CRASH) {
 		// Car crashed
-		set_display_attribute(BG_RED);
+		colour = CELL_CRASH;
 	} else if(colr == COLOUR_POWERUP) {
 		// Car powered up
-		set_display_attribute(BG_GREEN);
+		colour = CELL_POWERUP;
 	}
-	move_cursor(37+column,21);
-	printf_P(PSTR(" "));
-	move_cursor(37+column,22);
-	printf_P(PSTR(" "));
-	normal_display_mode();
-	move_cursor(37,8);
+	set_cell(1, column, colour);
+	set_cell(2, column, colour);
 }
 
 /* Does the same thing as erase_car() in game.c. Background detection
  * done in game.c.
  */
 void term_erase_car(uint8_t bg1, uint8_t bg2, uint8_t column) {
-	move_cursor(37+column,22);
-	if(bg1) {
-		// Is background, colour blue
-		set_display_attribute(BG_BLUE);
-		printf_P(PSTR(" "));
-		normal_display_mode();
-	} else {
-		// Not background, colour black
-		printf_P(PSTR(" "));
+	// Background is blue, otherwise black
+	set_cell(1, column, bg1 ? CELL_BACKGROUND : CELL_BLACK);
+	set_cell(2, column, bg2 ? CELL_BACKGROUND : CELL_BLACK);
+}
+
+/* Does the same thing as redraw_powerup() in game.c.
+ */
+void term_redraw_powerup(uint8_t row, uint8_t column, uint8_t colr) {
+	if(row >= NUM_ROWS) {
+		return;
 	}
+	set_cell(row, column, colr == COLOUR_POWERUP ? CELL_POWERUP : CELL_BLACK);
+}
 
-	move_cursor(37+column,21);
-	if(bg2) {
-		// Is background, colour blue
-		set_display_attribute(BG_BLUE);
-		printf_P(PSTR(" "));
-		normal_display_mode();
-	} else {
-		// Not background, colour black
-		printf_P(PSTR(" "));
+/* Does the same thing as ledmatrix_shift_display_right() in game.c -
+ * scrolls the playfield down by one row. The new top row is blank.
+ */
+void term_scroll_down(void) {
+	uint32_t bytes_before;
+	uint8_t column;
+
+	if(half_blocks && phase == 0) {
+		// The bottom row will be shown as the row below the playfield
+		for(column = 0; column < NUM_COLUMNS; column++) {
+			below[column] = SHOWN(cells[0][column]);
+		}
+	}
+
+	// Everything moves down a row, both on the terminal and in our record
+	memmove(&cells[0][0], &cells[1][0], (NUM_ROWS - 1) * NUM_COLUMNS);
+	memset(&cells[NUM_ROWS - 1][0], 0, NUM_COLUMNS);
+
+	if(half_blocks) {
+		phase ^= 1;
+		if(phase == 1) {
+			// Same terminal cells, just shown as different rows
+			return;
+		}
+		// The line below the playfield scrolls off the terminal
+		memset(below, 0, NUM_COLUMNS);
+	}
+
+	if(telemetry_mode() == TELEMETRY_ONLY) {
+		return;
+	}
+	if(!room_for(SCROLL_MAX_BYTES)) {
+		// The terminal is left as it is - and redrawn by term_flush()
+		forget_shown();
+		return;
 	}
+	// With the cursor on the top row of the scroll region, this scrolls
+	// the region down.
+	bytes_before = serial_bytes_queued();
+	move_cursor(PLAYFIELD_LEFT, half_blocks ? HALF_TOP : PLAYFIELD_TOP);
+	scroll_down();
+	stats.bytes += serial_bytes_queued() - bytes_before;
 
-	move_cursor(37,8);
+	// Playfield bytes sent since the last scroll - i.e. the cost of one
+	// scroll step including the new row and moving the car
+	stats.scrolls++;
+	stats.last_scroll_bytes = stats.bytes - bytes_at_last_scroll;
+	bytes_at_last_scroll = stats.bytes;
 }
 
-/* Does the same thing as redraw_powerup() in game.c.
+void term_reset(void) {
+	memset(cells, 0, sizeof(cells));
+	memset(below, 0, sizeof(below));
+	phase = 0;
+	set_scroll_region(half_blocks ? HALF_TOP : PLAYFIELD_TOP, PLAYFIELD_BOTTOM);
+}
+
+void term_set_half_blocks(uint8_t on) {
+	half_blocks = on;
+}
+
+/* Send the cells that have changed (when not in half block mode).
  */
-void term_redraw_powerup(uint8_t row, uint8_t column, uint8_t colr) {
-	move_cursor(37+column,23-row);
-	if(colr == COLOUR_POWERUP) {
-		set_display_attribute(BG_GREEN);
-		printf_P(PSTR(" "));
-		normal_display_mode();
+static void flush_cells(void) {
+	uint8_t row, column, run_end, next;
+	uint8_t colour, count;
+
+	for(row = 0; row < NUM_ROWS; row++) {
+		column = 0;
+		while(column < NUM_COLUMNS) {
+			if(!cell_changed(row, column)) {
+				column++;
+				continue;
+			}
+			// Find the end of the run of changed cells. Unchanged cells
+			// before the next changed one are sent again if that is
+			// cheaper than moving the cursor past them.
+			run_end = column + 1;
+			while(1) {
+				next = run_end;
+				while(next < NUM_COLUMNS && !cell_changed(row, next)) {
+					next++;
+				}
+				if(next == NUM_COLUMNS || resend_cost(row, run_end, next) >
+						cursor_move_cost(PLAYFIELD_LEFT + run_end, PLAYFIELD_BOTTOM - row,
+						PLAYFIELD_LEFT + next, PLAYFIELD_BOTTOM - row)) {
+					break;
+				}
+				run_end = next + 1;
+			}
+
+			// Send the run, if there is room for it (otherwise it and
+			// the rest are sent next time)
+			if(!room_for(RUN_MAX_BYTES + STYLE_MAX_BYTES)) {
+				return;
+			}
+			move_cursor(PLAYFIELD_LEFT + column, PLAYFIELD_BOTTOM - row);
+			while(column < run_end) {
+				// Cells of the same colour are sent together (as one
+				// repeated space if the terminal can do that)
+				colour = WANTED(cells[row][column]);
+				for(count = 0; column + count < run_end &&
+						WANTED(cells[row][column + count]) == colour; count++) {
+					cells[row][column + count] = (colour << 4) | colour;
+				}
+				set_text_style(FG_DEFAULT, pgm_read_byte(&cell_background[colour]), 0);
+				put_spaces(count);
+				column += count;
+			}
+		}
+	}
+}
+
+void term_flush(void) {
+	uint32_t bytes_before;
+
+	if(telemetry_mode() == TELEMETRY_ONLY) {
+		return;
+	}
+	bytes_before = serial_bytes_queued();
+	if(half_blocks) {
+		flush_half_blocks();
 	} else {
-		printf_P(PSTR(" "));
+		flush_cells();
+	}
+	if(room_for(STYLE_MAX_BYTES)) {
+		normal_display_mode();
 	}
-	move_cursor(37,8);
-}
\ No newline at end of file
+	stats.bytes += serial_bytes_queued() - bytes_before;
+}
+
+void term_get_stats(TermStats* snapshot) {
+	*snapshot = stats;
+}
+
+void term_reset_stats(void) {
+	memset(&stats, 0, sizeof(stats));
+	bytes_at_last_scroll = 0;
+}
@@ -9,15 +9,55 @@
 
 #include <stdint.h>
 
-/* All functions below are similar to their counterparts
+/* Number of game rows shown on the terminal (the bottom ones, if the LED
+ * matrix shows more).
+ */
+#define TERM_NUM_ROWS 16
+
+/* The functions below are similar to their counterparts
  * in game.c, difference being terminal output instead of
  * LED matrix output. Should be called right after counterparts in
- * game.c.
+ * game.c. Nothing is sent until term_flush() (except for scrolling).
+ * Rows from TERM_NUM_ROWS up are ignored.
  */
 void term_redraw_game_row(uint8_t row);
 void term_draw_start_or_finish_line(uint8_t row);
 void term_redraw_car(uint8_t colr, uint8_t column);
 void term_erase_car(uint8_t bg1, uint8_t bg2, uint8_t column);
 void term_redraw_powerup(uint8_t row, uint8_t column, uint8_t colr);
+void term_scroll_down(void);
+
+/* Counters for the bytes sent to draw the playfield (cells and scrolls).
+ */
+typedef struct {
+	uint32_t bytes;				// Total bytes sent
+	uint16_t scrolls;			// Number of scrolls
+	uint16_t last_scroll_bytes;	// Bytes sent between the last two scrolls
+} TermStats;
+
+/* Forget what the terminal is showing - call after clearing it. Every
+ * cell is then taken to be black, on the terminal and as drawn. Also sets
+ * the scroll region the playfield scrolls in.
+ */
+void term_reset(void);
+
+/* Turn half block mode on (1) or off (0). In this mode each terminal cell
+ * shows two game rows (using Unicode half block characters, so the
+ * terminal must be using UTF-8), which halves the cells sent and the
+ * scrolls. The host turns it on and off with HOST_COMMAND_HALF_BLOCKS
+ * (see serialio.h). The terminal must be cleared and the playfield
+ * redrawn (and term_reset() called) after changing mode.
+ */
+void term_set_half_blocks(uint8_t on);
+
+/* Send the playfield cells that have changed since they were last sent.
+ * Should be called after drawing (e.g. once per pass of the game loop).
+ */
+void term_flush(void);
+
+/* Copy the playfield counters into *snapshot, or zero them.
+ */
+void term_get_stats(TermStats* snapshot);
+void term_reset_stats(void);
 
 #endif /* TERM_H_ */
\ No newline at end of file
@@ -2,6 +2,20 @@
  * terminalio.c
  *
  * Author: Peter Sutton
+ *
+ * The cursor position is tracked so that move_cursor() can use whichever
+ * way of getting there takes the fewest bytes (in the manner of curses'
+ * mvcur()). The position is only trusted while no other output has been
+ * queued since we last knew it - any output we don't know the effect of
+ * (e.g. a message or a number) changes the serial bytes_queued count and so
+ * makes the next move_cursor() use an absolute position again.
+ *
+ * Runs of spaces are sent with REP (repeat the last character) or ECH
+ * (erase characters) when the terminal supports them and they are shorter.
+ * ECH support is found from the terminal's reply to a Device Attributes
+ * request (see request_terminal_attributes()). REP is only used once the
+ * host has said the terminal has it (see set_terminal_repeat()). Until
+ * then (or if no reply ever arrives) spaces are sent one by one.
  */
 
 #include <stdio.h>
@@ -10,66 +24,399 @@
 #include <avr/pgmspace.h>
 
 #include "terminalio.h"
+#include "serialio.h"
+#include "textout.h"
+
+
+// A run of spaces in program memory. Horizontal lines are sent from here
+// (in pieces if necessary) rather than one character at a time.
+#define SPACES_LENGTH 32
+static const char spaces[SPACES_LENGTH] PROGMEM = "                                ";
+
+// Display attributes the terminal is using. Until the first attributes
+// are sent we don't know, so the first set_text_style() starts with a
+// reset.
+static uint8_t current_foreground = FG_DEFAULT;
+static uint8_t current_background = BG_DEFAULT;
+static uint16_t current_flags = 0;
+static uint8_t attributes_known = 0;
+
+// Cursor position (if cursor_known), valid only while the serial byte
+// count is still cursor_mark. Also the scroll region.
+static int8_t cursor_x, cursor_y;
+static uint8_t cursor_known = 0;
+static uint32_t cursor_mark;
+static int8_t scroll_top = 1;
+static int8_t scroll_bottom = INT8_MAX;
+
+// Conformance level from the terminal's Device Attributes reply (e.g. 62
+// for a VT220), or 0 if it hasn't replied. ECH first appeared in the
+// VT220. REP is an ECMA-48/xterm extension that many terminals reporting
+// a high level don't have, so it is only used once the host says so.
+#define LEVEL_ECH 62
+static volatile uint8_t terminal_level = 0;
+static uint8_t repeat_supported = 0;
+
+// Width of the terminal. Text that reaches the last column leaves the
+// cursor in a state that differs between terminals.
+#define TERMINAL_WIDTH 80
+
+/* Return 1 if we know where the cursor is, 0 otherwise.
+ */
+static uint8_t cursor_valid(void) {
+	return cursor_known && serial_bytes_queued() == cursor_mark;
+}
+
+/* Record the cursor position after sending something. If valid is 0 the
+ * position is not known.
+ */
+static void cursor_sync(int8_t x, int8_t y, uint8_t valid) {
+	cursor_x = x;
+	cursor_y = y;
+	cursor_known = valid;
+	cursor_mark = serial_bytes_queued();
+}
+
+/* Return 1 if the cursor can be moved from row from_y to row to_y with a
+ * relative move. Relative moves stop at the edges of the scroll region, so
+ * they can only be used within it.
+ */
+static uint8_t vertical_move_possible(int8_t from_y, int8_t to_y) {
+	return from_y == to_y || (from_y >= scroll_top && from_y <= scroll_bottom &&
+			to_y >= scroll_top && to_y <= scroll_bottom);
+}
+
+/* Number of characters needed to write value in decimal.
+ */
+static uint8_t digits(uint8_t value) {
+	return value >= 100 ? 3 : (value >= 10 ? 2 : 1);
+}
+
+/* Cost of the sequence ESC [ n <c> which moves the cursor n places (n can
+ * be left out if it is 1).
+ */
+static uint8_t relative_cost(uint8_t n) {
+	return n == 1 ? 3 : 3 + digits(n);
+}
+
+/* Send ESC [ n <final>, leaving n out if it is 1.
+ */
+static void put_relative(uint8_t n, char final) {
+	uint8_t first = 1;
 
+	put_csi();
+	if(n != 1) {
+		put_csi_parameter(n, &first);
+	}
+	putchar(final);
+}
+
+/* Ways of moving the cursor horizontally (see horizontal_move()) */
+#define MOVE_NONE 0
+#define MOVE_RIGHT 1
+#define MOVE_LEFT 2
+#define MOVE_BACKSPACE 3
+#define MOVE_RETURN 4
+
+/* Work out the cheapest way of moving the cursor from column from_x to
+ * column to_x on the same row. Returns the cost in bytes and stores the
+ * method in *method.
+ */
+static uint8_t horizontal_move(int8_t from_x, int8_t to_x, uint8_t* method) {
+	uint8_t cost;
+
+	if(to_x == from_x) {
+		*method = MOVE_NONE;
+		return 0;
+	} else if(to_x > from_x) {
+		*method = MOVE_RIGHT;
+		return relative_cost(to_x - from_x);
+	}
+	// Moving left - cursor back, backspaces or a carriage return (and
+	// then right if need be)
+	*method = MOVE_LEFT;
+	cost = relative_cost(from_x - to_x);
+	if(from_x - to_x < cost) {
+		*method = MOVE_BACKSPACE;
+		cost = from_x - to_x;
+	}
+	if(1 + (to_x > 1 ? relative_cost(to_x - 1) : 0) < cost) {
+		*method = MOVE_RETURN;
+		cost = 1 + (to_x > 1 ? relative_cost(to_x - 1) : 0);
+	}
+	return cost;
+}
+
+uint8_t cursor_move_cost(int8_t from_x, int8_t from_y, int8_t to_x, int8_t to_y) {
+	uint8_t method;
+	uint8_t absolute = 4 + digits(to_x) + digits(to_y);
+	uint8_t relative = horizontal_move(from_x, to_x, &method);
+
+	if(!vertical_move_possible(from_y, to_y)) {
+		return absolute;
+	}
+	if(to_y != from_y) {
+		relative += relative_cost(to_y > from_y ? to_y - from_y : from_y - to_y);
+	}
+	return relative < absolute ? relative : absolute;
+}
 
 void move_cursor(int8_t x, int8_t y) {
-    printf_P(PSTR("\x1b[%d;%dH"), y, x);
+	uint8_t first = 1;
+	uint8_t method, cost;
+
+	if(cursor_valid() && vertical_move_possible(cursor_y, y)) {
+		if(x == cursor_x && y == cursor_y) {
+			return; // Already there
+		}
+		cost = horizontal_move(cursor_x, x, &method);
+		if(y != cursor_y) {
+			cost += relative_cost(y > cursor_y ? y - cursor_y : cursor_y - y);
+		}
+		if(cost < 4 + digits(x) + digits(y)) {
+			// Relative moves are cheaper
+			if(y < cursor_y) {
+				put_relative(cursor_y - y, 'A');
+			} else if(y > cursor_y) {
+				put_relative(y - cursor_y, 'B');
+			}
+			switch(method) {
+				case MOVE_RIGHT:
+					put_relative(x - cursor_x, 'C');
+					break;
+				case MOVE_LEFT:
+					put_relative(cursor_x - x, 'D');
+					break;
+				case MOVE_BACKSPACE:
+					for(cost = cursor_x - x; cost > 0; cost--) {
+						putchar('\b');
+					}
+					break;
+				case MOVE_RETURN:
+					putchar('\r');
+					if(x > 1) {
+						put_relative(x - 1, 'C');
+					}
+					break;
+			}
+			cursor_sync(x, y, 1);
+			return;
+		}
+	}
+
+	// Absolute position
+	put_csi();
+	put_csi_parameter(y, &first);
+	put_csi_parameter(x, &first);
+	putchar('H');
+	cursor_sync(x, y, 1);
+}
+
+void cursor_advanced(uint8_t count) {
+	uint8_t valid = cursor_known &&
+			serial_bytes_queued() - cursor_mark == count &&
+			cursor_x + count <= TERMINAL_WIDTH;
+	cursor_sync(cursor_x + count, cursor_y, valid);
+}
+
+void request_terminal_attributes(void) {
+	uint8_t valid = cursor_valid();
+	serial_put_P(PSTR("\x1b[c"));
+	cursor_sync(cursor_x, cursor_y, valid);
+}
+
+void set_terminal_level(uint8_t level) {
+	terminal_level = level;
+}
+
+void set_terminal_repeat(uint8_t on) {
+	repeat_supported = on;
+}
+
+void put_spaces(uint8_t count) {
+	uint8_t valid = cursor_valid();
+	int8_t x = cursor_x;
+	uint8_t remaining, length;
+
+	if(count == 0) {
+		return;
+	}
+	if(repeat_supported && 1 + relative_cost(count - 1) < count) {
+		// One space, then repeat it
+		putchar(' ');
+		put_relative(count - 1, 'b');
+	} else if(terminal_level >= LEVEL_ECH && attributes_known && current_flags == 0 &&
+			current_background == BG_DEFAULT && 2 * relative_cost(count) < count) {
+		// Erase the characters, then move past them. (Only for blanks -
+		// not every terminal erases with the current background colour,
+		// and none erase in reverse video.)
+		put_relative(count, 'X');
+		put_relative(count, 'C');
+	} else {
+		for(remaining = count; remaining > 0; remaining -= length) {
+			length = remaining < SPACES_LENGTH ? remaining : SPACES_LENGTH;
+			serial_put_P_len(spaces, length);
+		}
+	}
+	cursor_sync(x + count, cursor_y, valid && x + count <= TERMINAL_WIDTH);
+}
+
+// Difference between a background colour and the same foreground colour
+#define FOREGROUND(background) ((background) - (BG_BLACK - FG_BLACK))
+
+void put_half_blocks(DisplayParameter upper, DisplayParameter lower) {
+	uint8_t valid;
+	int8_t x = cursor_x;
+
+	if(upper == lower) {
+		// Just a space
+		set_text_style(current_foreground, upper, 0);
+		valid = cursor_valid();
+		putchar(' ');
+	} else {
+		if(upper == BG_DEFAULT || (lower != BG_DEFAULT &&
+				(current_background == upper || current_foreground == FOREGROUND(lower)))) {
+			// Lower half block in the lower colour on the upper colour
+			set_text_style(FOREGROUND(lower), upper, 0);
+			valid = cursor_valid();
+			putchar('\xe2');	// U+2584 in UTF-8
+			putchar('\x96');
+			putchar('\x84');
+		} else {
+			// Upper half block in the upper colour on the lower colour
+			set_text_style(FOREGROUND(upper), lower, 0);
+			valid = cursor_valid();
+			putchar('\xe2');	// U+2580 in UTF-8
+			putchar('\x96');
+			putchar('\x80');
+		}
+	}
+	cursor_sync(x + 1, cursor_y, valid && x + 1 <= TERMINAL_WIDTH);
 }
 
 void normal_display_mode(void) {
-	printf_P(PSTR("\x1b[0m"));
+	set_text_style(FG_DEFAULT, BG_DEFAULT, 0);
 }
 
 void reverse_video(void) {
-	printf_P(PSTR("\x1b[7m"));
+	set_display_attribute(TERM_REVERSE);
 }
 
 void clear_terminal(void) {
-	printf_P(PSTR("\x1b[2J"));
+	uint8_t valid = cursor_valid();
+	serial_put_P(PSTR("\x1b[2J"));
+	cursor_sync(cursor_x, cursor_y, valid);
 }
 
 void clear_to_end_of_line(void) {
-	printf_P(PSTR("\x1b[K"));
+	uint8_t valid = cursor_valid();
+	serial_put_P(PSTR("\x1b[K"));
+	cursor_sync(cursor_x, cursor_y, valid);
 }
 
 void set_display_attribute(DisplayParameter parameter) {
-	printf_P(PSTR("\x1b[%dm"), parameter);
+	if(parameter == TERM_RESET) {
+		set_text_style(FG_DEFAULT, BG_DEFAULT, 0);
+	} else if(parameter >= FG_BLACK && parameter <= FG_DEFAULT) {
+		set_text_style(parameter, current_background, current_flags);
+	} else if(parameter >= BG_BLACK && parameter <= BG_DEFAULT) {
+		set_text_style(current_foreground, parameter, current_flags);
+	} else {
+		set_text_style(current_foreground, current_background,
+				current_flags | STYLE(parameter));
+	}
+}
+
+void set_text_style(DisplayParameter foreground, DisplayParameter background, uint16_t flags) {
+	uint8_t first = 1;
+	uint8_t valid = cursor_valid();
+	uint8_t i;
+
+	if(attributes_known && foreground == current_foreground &&
+			background == current_background && flags == current_flags) {
+		return; // Nothing to change
+	}
+
+	put_csi();
+	if(!attributes_known || (current_flags & ~flags)) {
+		// Attributes other than colours can only be turned off by a reset,
+		// which puts everything back to the default
+		put_csi_parameter(TERM_RESET, &first);
+		current_foreground = FG_DEFAULT;
+		current_background = BG_DEFAULT;
+		current_flags = 0;
+	}
+	for(i = TERM_BRIGHT; i <= TERM_HIDDEN; i++) {
+		if((flags & ~current_flags) & STYLE(i)) {
+			put_csi_parameter(i, &first);
+		}
+	}
+	if(foreground != current_foreground) {
+		put_csi_parameter(foreground, &first);
+	}
+	if(background != current_background) {
+		put_csi_parameter(background, &first);
+	}
+	putchar('m');
+
+	current_foreground = foreground;
+	current_background = background;
+	current_flags = flags;
+	attributes_known = 1;
+	cursor_sync(cursor_x, cursor_y, valid);
 }
 
 void hide_cursor() {
-	printf_P(PSTR("\x1b[?25l"));
+	uint8_t valid = cursor_valid();
+	serial_put_P(PSTR("\x1b[?25l"));
+	cursor_sync(cursor_x, cursor_y, valid);
 }
 
 void show_cursor() {
-	printf_P(PSTR("\x1b[?25h"));
+	uint8_t valid = cursor_valid();
+	serial_put_P(PSTR("\x1b[?25h"));
+	cursor_sync(cursor_x, cursor_y, valid);
 }
 
 void enable_scrolling_for_whole_display(void) {
-	printf_P(PSTR("\x1b[r"));
+	serial_put_P(PSTR("\x1b[r"));
+	scroll_top = 1;
+	scroll_bottom = INT8_MAX;
+	// Setting the scroll region moves the cursor to the top left
+	cursor_sync(1, 1, 1);
 }
 
 void set_scroll_region(int8_t y1, int8_t y2) {
-	printf_P(PSTR("\x1b[%d;%dr"), y1, y2);
+	uint8_t first = 1;
+
+	put_csi();
+	put_csi_parameter(y1, &first);
+	put_csi_parameter(y2, &first);
+	putchar('r');
+	scroll_top = y1;
+	scroll_bottom = y2;
+	// Setting the scroll region moves the cursor to the top left
+	cursor_sync(1, 1, 1);
 }
 
 void scroll_down(void) {
-	printf_P(PSTR("\x1bM"));	// ESC-M
+	uint8_t valid = cursor_valid() && cursor_y >= scroll_top && cursor_y <= scroll_bottom;
+	serial_put_P(PSTR("\x1bM"));	// ESC-M
+	// The cursor only moves if it is not on the top row
+	cursor_sync(cursor_x, cursor_y == scroll_top ? cursor_y : cursor_y - 1, valid);
 }
 
 void scroll_up(void) {
-	printf_P(PSTR("\x1b\x44"));	// ESC-D
+	uint8_t valid = cursor_valid() && cursor_y >= scroll_top && cursor_y <= scroll_bottom;
+	serial_put_P(PSTR("\x1b\x44"));	// ESC-D
+	// The cursor only moves if it is not on the bottom row
+	cursor_sync(cursor_x, cursor_y == scroll_bottom ? cursor_y : cursor_y + 1, valid);
 }
 
 void draw_horizontal_line(int8_t y, int8_t start_x, int8_t end_x) {
-	int8_t i;
 	move_cursor(start_x, y);
 	reverse_video();
-	for(i=start_x; i <= end_x; i++) {
-		printf(" ");	/* No need to use printf_P - printing 
-						 * a single character gets optimised
-						 * to a putchar call 
-						 */
-	}
+	put_spaces(end_x - start_x + 1);
 	normal_display_mode();
 }
 
@@ -78,10 +425,10 @@ void draw_vertical_line(int8_t x, int8_t start_y, int8_t end_y) {
 	move_cursor(x, start_y);
 	reverse_video();
 	for(i=start_y; i < end_y; i++) {
-		printf(" ");
+		putchar(' ');
 		/* Move down one and back to the left one */
-		printf_P(PSTR("\x1b[B\x1b[D"));
+		serial_put_P(PSTR("\x1b[B\x1b[D"));
 	}
-	printf(" ");
+	putchar(' ');
 	normal_display_mode();
 }
\ No newline at end of file
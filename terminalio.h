@@ -27,6 +27,10 @@
  *	7 Reverse Video				35 Magenta			45 Magenta
  *	8 Hidden					36 Cyan				46 Cyan
  *								37 White			47 White
+ *								39 Default			49 Default
+ *
+ * The attributes the terminal is using are remembered, so asking for an
+ * attribute that is already set sends nothing.
  */
 
 typedef enum { TERM_RESET = 0, TERM_BRIGHT = 1, TERM_DIM = 2, TERM_UNDERSCORE = 4, 
@@ -34,15 +38,62 @@ typedef enum { TERM_RESET = 0, TERM_BRIGHT = 1, TERM_DIM = 2, TERM_UNDERSCORE =
 		FG_BLACK = 30, FG_RED = 31, FG_GREEN = 32, FG_YELLOW= 33, 
 		FG_BLUE = 34, FG_MAGENTA = 35, FG_CYAN = 36, FG_WHITE = 37,
 		BG_BLACK = 40, BG_RED = 41, BG_GREEN = 42, BG_YELLOW = 43,
-		BG_BLUE = 44, BG_MAGENTA = 45, BG_CYAN = 46, BG_WHITE = 47
+		FG_DEFAULT = 39,
+		BG_BLUE = 44, BG_MAGENTA = 45, BG_CYAN = 46, BG_WHITE = 47,
+		BG_DEFAULT = 49
 		} DisplayParameter;
 
+// Bit for an attribute (TERM_BRIGHT to TERM_HIDDEN) in the flags given to
+// set_text_style()
+#define STYLE(attribute) (1 << (attribute))
+
+// Move the cursor, using whichever sequence is shortest (see
+// cursor_move_cost())
 void move_cursor(int8_t x, int8_t y);
+
+// Return the number of bytes move_cursor() would take to move the cursor
+// from (from_x, from_y) to (to_x, to_y). Callers can compare this with the cost of just printing the
+// characters in between.
+uint8_t cursor_move_cost(int8_t from_x, int8_t from_y, int8_t to_x, int8_t to_y);
+
+// Tell the cursor tracker that count characters have just been printed
+// (since the last move_cursor() or change of display attributes) so the
+// cursor has moved right by that much. Without this, move_cursor() uses an
+// absolute position after any text is printed.
+void cursor_advanced(uint8_t count);
+
+// Ask the terminal which features it supports (by sending a Device
+// Attributes request). The reply is picked out of the input by the key
+// decoder (see keyboard.h), which passes the conformance level it reports
+// to set_terminal_level().
+void request_terminal_attributes(void);
+void set_terminal_level(uint8_t level);
+
+// Say whether the terminal supports REP (repeat the last character).
+// Terminals don't reliably report it, so it is off until the host turns
+// it on with HOST_COMMAND_REPEAT (see serialio.h).
+void set_terminal_repeat(uint8_t on);
+
+// Print count spaces in the current display attributes, using REP or ECH
+// if the terminal supports them and that is shorter
+void put_spaces(uint8_t count);
+
+// Print one character cell whose top half is one colour and bottom half
+// another (given as background colours, e.g. BG_RED - BG_DEFAULT is left
+// as the terminal's own background). Uses the Unicode half block
+// characters, so the terminal must be using UTF-8. Leaves the colours
+// set, and picks the glyph that needs the fewest colour changes.
+void put_half_blocks(DisplayParameter upper, DisplayParameter lower);
 void normal_display_mode(void);
 void reverse_video(void);
 void clear_terminal(void);
 void clear_to_end_of_line(void);
 void set_display_attribute(DisplayParameter parameter);
+
+// Set the foreground colour, background colour and other attributes
+// (STYLE() bits, e.g. STYLE(TERM_BRIGHT)) all at once. Only the changes
+// are sent, in a single escape sequence.
+void set_text_style(DisplayParameter foreground, DisplayParameter background, uint16_t flags);
 void hide_cursor(void);
 void show_cursor(void);
 
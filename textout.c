@@ -0,0 +1,92 @@
+/*
+ * textout.c
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Numbers are converted by subtracting powers of ten rather than
+ * dividing, as 32 bit division is slow on the AVR.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <avr/pgmspace.h>
+
+#include "textout.h"
+#include "serialio.h"
+
+static const uint32_t powers_of_ten[] PROGMEM = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
+
+uint8_t format_unsigned(char* text, uint32_t value) {
+	uint8_t length = 0;
+	uint8_t i;
+	uint32_t power;
+	char digit;
+
+	for(i = 0; i < sizeof(powers_of_ten) / sizeof(powers_of_ten[0]); i++) {
+		power = pgm_read_dword(&powers_of_ten[i]);
+		digit = '0';
+		while(value >= power) {
+			value -= power;
+			digit++;
+		}
+		// No leading zeros
+		if(digit != '0' || length) {
+			text[length++] = digit;
+		}
+	}
+	text[length++] = '0' + value;
+	return length;
+}
+
+uint8_t format_tenths(char* text, uint16_t tenths) {
+	uint8_t length = format_unsigned(text, tenths / 10);
+	text[length++] = '.';
+	text[length++] = '0' + tenths % 10;
+	return length;
+}
+
+/* Send length characters of text to a stream.
+ */
+static void put_text(const char* text, uint8_t length, FILE* stream) {
+	uint8_t i;
+
+	if(stream == stdout) {
+		// Straight into the output buffer
+		serial_write(text, length);
+		return;
+	}
+	for(i = 0; i < length; i++) {
+		fputc(text[i], stream);
+	}
+}
+
+void fput_unsigned(uint32_t value, FILE* stream) {
+	char text[FORMAT_UNSIGNED_LENGTH];
+	put_text(text, format_unsigned(text, value), stream);
+}
+
+void fput_tenths(uint16_t tenths, FILE* stream) {
+	char text[FORMAT_TENTHS_LENGTH];
+	put_text(text, format_tenths(text, tenths), stream);
+}
+
+void put_csi(void) {
+	putchar('\x1b');
+	putchar('[');
+}
+
+void put_csi_parameter(uint8_t value, uint8_t* first) {
+	if(!*first) {
+		putchar(';');
+	}
+	*first = 0;
+	if(value >= 100) {
+		putchar('0' + value / 100);
+	}
+	if(value >= 10) {
+		putchar('0' + (value / 10) % 10);
+	}
+	putchar('0' + value % 10);
+}
@@ -0,0 +1,46 @@
+/*
+ * textout.h
+ *
+ * Author: Thuan Song Teoh
+ *
+ * Small output functions for numbers and escape sequences, used instead
+ * of printf() (whose formatting code is large, slow and needs a lot of
+ * stack). The format_ functions write characters into a buffer (no
+ * terminating null) and return how many they wrote; the put_ functions
+ * send them.
+ */
+
+#ifndef TEXTOUT_H_
+#define TEXTOUT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest text format_unsigned() and format_tenths() produce
+#define FORMAT_UNSIGNED_LENGTH 10
+#define FORMAT_TENTHS_LENGTH 7
+
+/* Write value in decimal, e.g. "12345".
+ */
+uint8_t format_unsigned(char* text, uint32_t value);
+
+/* Write a number of tenths as a decimal with one place, e.g. "12.3".
+ */
+uint8_t format_tenths(char* text, uint16_t tenths);
+
+/* Send a number, as formatted by the functions above, to a stream (the
+ * put_ versions send it to stdout).
+ */
+void fput_unsigned(uint32_t value, FILE* stream);
+void fput_tenths(uint16_t tenths, FILE* stream);
+#define put_unsigned(value) fput_unsigned(value, stdout)
+#define put_tenths(tenths) fput_tenths(tenths, stdout)
+
+/* Send the start of a control sequence (ESC [), then its numeric
+ * parameters one at a time. first must be set to 1 before the first
+ * parameter - it is used to put a ; between parameters.
+ */
+void put_csi(void);
+void put_csi_parameter(uint8_t value, uint8_t* first);
+
+#endif /* TEXTOUT_H_ */
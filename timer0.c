@@ -13,6 +13,7 @@
 
 #include "timer0.h"
 #include "project.h"
+#include "serialio.h"
 
 /* Our internal clock tick count - incremented every 
  * millisecond. Will overflow every ~49 days. */
@@ -74,9 +75,32 @@ uint32_t get_timer0_clock_ticks(void) {
 	return return_value;
 }
 
+uint32_t get_timer0_microseconds(void) {
+	uint32_t ticks;
+	uint8_t count;
+
+	uint8_t interrupts_on = bit_is_set(SREG, SREG_I);
+	cli();
+	ticks = clock_ticks;
+	count = TCNT0;
+	if((TIFR0 & (1<<OCF0A)) && count < OCR0A) {
+		/* The timer has wrapped around but the interrupt handler
+		 * hasn't counted it yet */
+		ticks++;
+	}
+	if(interrupts_on) {
+		sei();
+	}
+	/* The timer counts every 8 microseconds */
+	return ticks * 1000 + count * 8;
+}
+
 ISR(TIMER0_COMPA_vect) {
 	/* Increment our clock tick count if not paused */
 	if(!is_paused()) {
 		clock_ticks++;
 	}
+
+	/* Time out unfinished escape sequences (even while paused) */
+	serial_input_tick();
 }
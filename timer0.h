@@ -30,4 +30,9 @@ void init_timer0(void);
  */
 uint32_t get_timer0_clock_ticks(void);
 
+/* Return the clock in microseconds (to the nearest 8), for timing short
+ * things. Like the clock tick value it stops while the game is paused.
+ */
+uint32_t get_timer0_microseconds(void);
+
 #endif
\ No newline at end of file